@@ -0,0 +1,299 @@
+#include "llvm/IR/Function.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Instruction.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/ValueMap.h"
+#include "llvm/Support/DataTypes.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+#include "OutputFile.cpp"
+#include <algorithm>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+using namespace std;
+
+/**
+ * Writes solved bit vector analysis results to a file, one
+ * record per function, so tools can read them back without
+ * running opt and parsing printed IR.
+ *
+ * The binary record is little endian and every section starts
+ * on an 8 byte boundary, so a mapped file can be read in place:
+ *
+ *   header    magic "LVX1", u32 version, numValues, numBlocks,
+ *             numInstructions, wordsPerSet, u64 recordSize and
+ *             the u64 offsets of values, blocks, instructions,
+ *             sets and strings from the record start, then
+ *             u32 name offset and length of the function
+ *   values    per bit: u32 nameOffset, nameLength, kind
+ *             (0 argument, 1 instruction), argument number
+ *             or instruction index
+ *   blocks    u32 nameOffset, nameLength, firstInstruction,
+ *             numInstructions
+ *   insts     u32 value bit, opcode
+ *   sets      in then out of every block, then of every
+ *             instruction, wordsPerSet u64 words each
+ *   strings   names, not null terminated
+ *
+ * The JSON format writes one object per function and line with
+ * the same tables and the sets as lists of bits.
+ */
+class AnalysisExporter {
+public:
+  enum Format { Binary, JSON };
+
+  AnalysisExporter(const char *Pass, const std::string &File, Format Fmt)
+    : Output(Pass, "export", File, Fmt == Binary ? sys::fs::F_Binary : sys::fs::F_None), Fmt(Fmt), OS(0) {}
+
+  /**
+   * Export is on when a file name was given and it could be
+   * opened.
+   */
+  bool enabled()
+  {
+    OS = Output.get();
+    return OS != 0;
+  }
+
+  /**
+   * Writes the record of F. Every block and instruction of F
+   * needs an entry in the flow data maps, and the in and out
+   * sets of those entries are the ones written.
+   */
+  template<class BlockData, class InstructionData>
+  void exportFunction(Function &F, ValueMap<Value *, int> &valueIndexMap,
+                      ValueMap<BasicBlock*, BlockData*> &blockFlowData,
+                      ValueMap<Value*, InstructionData*> &instructionFlowData)
+  {
+    if (!enabled())
+      return;
+
+    Record R;
+    R.values.resize(valueIndexMap.size());
+    for (ValueMap<Value *, int>::iterator it = valueIndexMap.begin(), ite = valueIndexMap.end(); it != ite; ++it)
+      R.values[it->second] = it->first;
+
+    unsigned argNo = 0;
+    for (Function::arg_iterator arg = F.arg_begin(), arge = F.arg_end(); arg != arge; ++arg)
+      R.numbers[&*arg] = argNo++;
+    for (Function::iterator b = F.begin(), be = F.end(); b != be; b++)
+    {
+      R.blocks.push_back(b);
+      R.firstInstruction.push_back(R.instructions.size());
+      for (BasicBlock::iterator i = b->begin(), ie = b->end(); i != ie; ++i)
+      {
+        R.numbers[&*i] = R.instructions.size();
+        R.instructions.push_back(i);
+      }
+    }
+    R.firstInstruction.push_back(R.instructions.size());
+
+    for (unsigned b = 0, be = R.blocks.size(); b != be; ++b)
+    {
+      R.sets.push_back(blockFlowData[R.blocks[b]]->in);
+      R.sets.push_back(blockFlowData[R.blocks[b]]->out);
+    }
+    for (unsigned i = 0, ie = R.instructions.size(); i != ie; ++i)
+    {
+      R.sets.push_back(instructionFlowData[R.instructions[i]]->in);
+      R.sets.push_back(instructionFlowData[R.instructions[i]]->out);
+    }
+
+    if (Fmt == Binary)
+      writeBinary(F, R, valueIndexMap);
+    else
+      writeJSON(F, R, valueIndexMap);
+  }
+
+private:
+  OutputFile Output;
+  Format Fmt;
+  raw_fd_ostream *OS;
+
+  struct Record {
+    vector<Value*> values;
+    vector<BasicBlock*> blocks;
+    vector<unsigned> firstInstruction;
+    vector<Instruction*> instructions;
+    //Argument number or instruction index of every value
+    ValueMap<Value*, unsigned> numbers;
+    //In and out of every block, then of every instruction
+    vector<BitVector*> sets;
+  };
+
+  static void writeU32(SmallVectorImpl<char> &Out, uint32_t V)
+  {
+    for (unsigned i = 0; i != 4; ++i)
+      Out.push_back((char)(V >> (8 * i)));
+  }
+
+  static void writeU64(SmallVectorImpl<char> &Out, uint64_t V)
+  {
+    for (unsigned i = 0; i != 8; ++i)
+      Out.push_back((char)(V >> (8 * i)));
+  }
+
+  static void patchU64(SmallVectorImpl<char> &Out, unsigned At, uint64_t V)
+  {
+    for (unsigned i = 0; i != 8; ++i)
+      Out[At + i] = (char)(V >> (8 * i));
+  }
+
+  static void align8(SmallVectorImpl<char> &Out)
+  {
+    while (Out.size() % 8)
+      Out.push_back(0);
+  }
+
+  // Adds S to the string table, writes its offset and length
+  static void writeString(SmallVectorImpl<char> &Out, std::string &Strings, StringRef S)
+  {
+    writeU32(Out, Strings.size());
+    writeU32(Out, S.size());
+    Strings.append(S.begin(), S.end());
+  }
+
+  void writeBinary(Function &F, Record &R, ValueMap<Value *, int> &valueIndexMap)
+  {
+    unsigned wordsPerSet = (R.values.size() + 63) / 64;
+    SmallVector<char, 4096> Out;
+    std::string Strings;
+
+    Out.push_back('L');
+    Out.push_back('V');
+    Out.push_back('X');
+    Out.push_back('1');
+    writeU32(Out, 1);
+    writeU32(Out, R.values.size());
+    writeU32(Out, R.blocks.size());
+    writeU32(Out, R.instructions.size());
+    writeU32(Out, wordsPerSet);
+    //Record size and section offsets are known once written
+    unsigned Offsets = Out.size();
+    for (unsigned i = 0; i != 6; ++i)
+      writeU64(Out, 0);
+    writeString(Out, Strings, F.getName());
+
+    align8(Out);
+    patchU64(Out, Offsets + 8, Out.size());
+    for (unsigned v = 0, ve = R.values.size(); v != ve; ++v)
+    {
+      writeString(Out, Strings, R.values[v]->getName());
+      writeU32(Out, isa<Argument>(R.values[v]) ? 0 : 1);
+      writeU32(Out, R.numbers[R.values[v]]);
+    }
+
+    align8(Out);
+    patchU64(Out, Offsets + 16, Out.size());
+    for (unsigned b = 0, be = R.blocks.size(); b != be; ++b)
+    {
+      writeString(Out, Strings, R.blocks[b]->getName());
+      writeU32(Out, R.firstInstruction[b]);
+      writeU32(Out, R.firstInstruction[b + 1] - R.firstInstruction[b]);
+    }
+
+    align8(Out);
+    patchU64(Out, Offsets + 24, Out.size());
+    for (unsigned i = 0, ie = R.instructions.size(); i != ie; ++i)
+    {
+      writeU32(Out, valueIndexMap[R.instructions[i]]);
+      writeU32(Out, R.instructions[i]->getOpcode());
+    }
+
+    align8(Out);
+    patchU64(Out, Offsets + 32, Out.size());
+    for (unsigned s = 0, se = R.sets.size(); s != se; ++s)
+    {
+      BitVector &Set = *R.sets[s];
+      for (unsigned w = 0; w != wordsPerSet; ++w)
+      {
+        uint64_t Word = 0;
+        for (unsigned bit = w * 64, end = std::min((unsigned)Set.size(), bit + 64); bit < end; ++bit)
+          if (Set.test(bit))
+            Word |= (uint64_t)1 << (bit % 64);
+        writeU64(Out, Word);
+      }
+    }
+
+    patchU64(Out, Offsets + 40, Out.size());
+    Out.append(Strings.begin(), Strings.end());
+    align8(Out);
+    patchU64(Out, Offsets, Out.size());
+
+    OS->write(Out.data(), Out.size());
+  }
+
+  static void writeJSONString(raw_ostream &O, StringRef S)
+  {
+    O << '"';
+    for (unsigned i = 0, e = S.size(); i != e; ++i)
+    {
+      unsigned char C = S[i];
+      if (C == '"' || C == '\\')
+        O << '\\' << C;
+      else if (C < 0x20)
+        O << "\\u00" << "0123456789abcdef"[C >> 4] << "0123456789abcdef"[C & 15];
+      else
+        O << C;
+    }
+    O << '"';
+  }
+
+  static void writeJSONSet(raw_ostream &O, BitVector &Set)
+  {
+    O << '[';
+    bool first = true;
+    for (int bit = Set.find_first(); bit != -1; bit = Set.find_next(bit))
+    {
+      O << (first ? "" : ",") << bit;
+      first = false;
+    }
+    O << ']';
+  }
+
+  void writeJSON(Function &F, Record &R, ValueMap<Value *, int> &valueIndexMap)
+  {
+    raw_ostream &O = *OS;
+    O << "{\"function\":";
+    writeJSONString(O, F.getName());
+
+    O << ",\"values\":[";
+    for (unsigned v = 0, ve = R.values.size(); v != ve; ++v)
+    {
+      O << (v ? "," : "") << "{\"name\":";
+      writeJSONString(O, R.values[v]->getName());
+      O << ",\"kind\":\"" << (isa<Argument>(R.values[v]) ? "argument" : "instruction")
+        << "\",\"index\":" << R.numbers[R.values[v]] << "}";
+    }
+
+    O << "],\"blocks\":[";
+    for (unsigned b = 0, be = R.blocks.size(); b != be; ++b)
+    {
+      O << (b ? "," : "") << "{\"name\":";
+      writeJSONString(O, R.blocks[b]->getName());
+      O << ",\"first\":" << R.firstInstruction[b]
+        << ",\"count\":" << R.firstInstruction[b + 1] - R.firstInstruction[b] << ",\"in\":";
+      writeJSONSet(O, *R.sets[2 * b]);
+      O << ",\"out\":";
+      writeJSONSet(O, *R.sets[2 * b + 1]);
+      O << "}";
+    }
+
+    O << "],\"instructions\":[";
+    unsigned base = 2 * R.blocks.size();
+    for (unsigned i = 0, ie = R.instructions.size(); i != ie; ++i)
+    {
+      O << (i ? "," : "") << "{\"value\":" << valueIndexMap[R.instructions[i]]
+        << ",\"opcode\":\"" << R.instructions[i]->getOpcodeName() << "\",\"in\":";
+      writeJSONSet(O, *R.sets[base + 2 * i]);
+      O << ",\"out\":";
+      writeJSONSet(O, *R.sets[base + 2 * i + 1]);
+      O << "}";
+    }
+    O << "]}\n";
+  }
+};
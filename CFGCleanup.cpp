@@ -0,0 +1,157 @@
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/CFG.h"
+#include "llvm/Analysis/CFG.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Local.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+
+using namespace llvm;
+
+/**
+ * CFG cleanup helpers run after instructions have been
+ * removed. They delete unreachable blocks, fold branches
+ * on constant conditions and merge straight line chains
+ * so that later passes and analyses see a smaller CFG.
+ */
+
+/**
+ * Delete every block that can not be reached from the
+ * entry block. If LI is given the blocks are also
+ * dropped from the loops that contain them.
+ */
+static bool deleteUnreachableBlocks(Function &F, LoopInfo *LI = 0)
+{
+  SmallPtrSet<BasicBlock*, 32> reachable;
+  SmallVector<BasicBlock*, 32> workList;
+  workList.push_back(&F.getEntryBlock());
+  reachable.insert(&F.getEntryBlock());
+
+  while (!workList.empty())
+  {
+    BasicBlock *BB = workList.pop_back_val();
+    for (succ_iterator next = succ_begin(BB), nexte = succ_end(BB); next != nexte; next++)
+      if (reachable.insert(*next))
+        workList.push_back(*next);
+  }
+
+  if (reachable.size() == F.size())
+    return false;
+
+  SmallVector<BasicBlock*, 16> deadBlocks;
+  for (Function::iterator b = F.begin(), be = F.end(); b != be; b++)
+    if (!reachable.count(b))
+      deadBlocks.push_back(b);
+
+  //Detach the dead blocks from the live part of the CFG first
+  for (unsigned i = 0, e = deadBlocks.size(); i != e; ++i)
+  {
+    BasicBlock *BB = deadBlocks[i];
+    for (succ_iterator next = succ_begin(BB), nexte = succ_end(BB); next != nexte; next++)
+      if (reachable.count(*next))
+        (*next)->removePredecessor(BB);
+    BB->dropAllReferences();
+  }
+
+  for (unsigned i = 0, e = deadBlocks.size(); i != e; ++i)
+  {
+    if (LI)
+      LI->removeBlock(deadBlocks[i]);
+    deadBlocks[i]->eraseFromParent();
+  }
+
+  return true;
+}
+
+/**
+ * Replace branches and switches on constant conditions
+ * with unconditional branches.
+ */
+static bool foldConstantBranches(SmallVectorImpl<BasicBlock*> &Blocks)
+{
+  bool changed = false;
+  for (unsigned i = 0, e = Blocks.size(); i != e; ++i)
+    changed |= ConstantFoldTerminator(Blocks[i], true);
+  return changed;
+}
+
+/**
+ * Remove blocks that contain nothing but an unconditional
+ * branch, their predecessors jump to the target directly.
+ * Loop headers and the blocks that branch to one, which
+ * are preheaders and latches, are kept so loops stay in
+ * the form loop passes expect.
+ */
+static bool removeForwardingBlocks(Function &F)
+{
+  SmallVector<std::pair<const BasicBlock*, const BasicBlock*>, 16> backEdges;
+  FindFunctionBackedges(F, backEdges);
+  SmallPtrSet<const BasicBlock*, 16> loopHeaders;
+  for (unsigned i = 0, e = backEdges.size(); i != e; ++i)
+    loopHeaders.insert(backEdges[i].second);
+
+  bool changed = false;
+  for (Function::iterator b = F.begin(), be = F.end(); b != be; )
+  {
+    BasicBlock *BB = b++;
+    if (BB == &F.getEntryBlock())
+      continue;
+
+    BranchInst *BI = dyn_cast<BranchInst>(BB->getTerminator());
+    if (!BI || !BI->isUnconditional() || BI->getSuccessor(0) == BB)
+      continue;
+    if (loopHeaders.count(BB) || loopHeaders.count(BI->getSuccessor(0)))
+      continue;
+    if (BB->getFirstNonPHIOrDbg() != BI)
+      continue;
+
+    changed |= TryToSimplifyUncondBranchFromEmptyBlock(BB);
+  }
+  return changed;
+}
+
+/**
+ * Merge every block into its predecessor when that
+ * predecessor has it as its only successor. If P is
+ * given its dominator tree and loop info are updated,
+ * so they have to be current when this is called.
+ */
+static bool mergeBlockChains(SmallVectorImpl<BasicBlock*> &Blocks, Pass *P)
+{
+  bool changed = false;
+  for (unsigned i = 0, e = Blocks.size(); i != e; ++i)
+    changed |= MergeBlockIntoPredecessor(Blocks[i], P);
+  return changed;
+}
+
+/**
+ * Run all of the cleanups above on F until nothing changes.
+ * The other steps do not keep analyses up to date, so the
+ * callers have to treat them as invalid afterwards.
+ */
+static bool cleanupCFG(Function &F)
+{
+  bool changed = false;
+  bool iterChanged;
+  do
+  {
+    SmallVector<BasicBlock*, 32> blocks;
+    for (Function::iterator b = F.begin(), be = F.end(); b != be; b++)
+      blocks.push_back(b);
+
+    iterChanged = foldConstantBranches(blocks);
+    iterChanged |= deleteUnreachableBlocks(F);
+    iterChanged |= removeForwardingBlocks(F);
+
+    blocks.clear();
+    for (Function::iterator b = F.begin(), be = F.end(); b != be; b++)
+      blocks.push_back(b);
+    iterChanged |= mergeBlockChains(blocks, 0);
+
+    changed |= iterChanged;
+  } while (iterChanged);
+
+  return changed;
+}
@@ -153,12 +153,12 @@ public:
       initializeInstructionUses(instructionFlowDataMap,valueIndexMap,F);
 
       setInitialFlowValues();
+      setBoundaryConditions();
       set<BasicBlock*> workList;
-      //value is initialized based on forward or backward analysis
-      if(!direction){
-	workList.insert(--(F.end()));
-      }else{
-	workList.insert(F.begin());
+      //every block is visited at least once, a single start block
+      //misses the other exits and blocks only reached by back edges
+      for (Function::iterator b = F.begin(), be = F.end(); b != be; b++){
+	workList.insert(b);
       }
 
       while(workList.size() > 0){
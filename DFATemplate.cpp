@@ -69,6 +69,9 @@ public:
     
   virtual void flowFunction(BasicBlock* block) = 0; 
   virtual void merge(BasicBlock* block) = 0;
+  //Flow values at the entry (forward) or exits (backward), set
+  //once all flow values are initialized
+  virtual void setBoundaryConditions(Function &F) {}
  
   
   void runAnalysis(Function &F){
@@ -211,17 +214,13 @@ public:
 	  it->second->def->set(mapValueToBit[it->first]);
       }
 
+      setBoundaryConditions(F);
+
        set<BasicBlock*> bbList; 
-      // Insert into worklist based on flow dir    
-      if(!direction)
-      {
-        //errs()<<--(F.end()).getName()<<"\n";
-	bbList.insert(--(F.end()));
-      }
-      else
-      {
-	bbList.insert(F.begin());
-      }
+      // Every block is visited once, a function may have several
+      // exits and blocks that are only reached by a back edge
+      for (Function::iterator b = F.begin(), be = F.end(); b != be; b++)
+	bbList.insert(b);
       
       for (typename ValueMap<Value*,  InsNode<T>*>::iterator it = flowForIns.begin(), ite = flowForIns.end(); it != ite; it++) 
       {
@@ -247,12 +246,12 @@ public:
         bbList.erase(bbList.begin()); 
 	merge(block);
 	
-        T prevInsValue = *(flowForBB[block]->in);
+        T prevValue = direction ? *(flowForBB[block]->out) : *(flowForBB[block]->in);
 	
 	flowFunction(block);
 	
         
-	  if (*(flowForBB[block]->in) != prevInsValue) 
+	  if (!direction && *(flowForBB[block]->in) != prevValue) 
           {	    
 	    for (pred_iterator PI = pred_begin(block), E = pred_end(block); PI != E; ++PI) 
             {
@@ -265,11 +264,21 @@ public:
 	    }
 	  
 	}
+	  else if (direction && *(flowForBB[block]->out) != prevValue)
+	  {
+	    for (succ_iterator SI = succ_begin(block), E = succ_end(block); SI != E; ++SI)
+	      bbList.insert(*SI);
+	  }
         
        
 	
       }
 
+      //The instruction level values below are liveness specific,
+      //forward clients read the block values
+      if (direction)
+        return;
+
       //push results to instruction level
       //propagateFlow from BB toIns; Needs to be modified
 
@@ -0,0 +1,290 @@
+#include "DFAFramework.cpp"
+#include "llvm/ADT/SmallVector.h"
+#include <algorithm>
+#include <vector>
+
+/**
+ * Common part of the forward bit vector analyses on top of
+ * DFAFramework. For these analyses the def set of a block or
+ * an instruction holds what it generates and the use set what
+ * it kills, so that out = def U (in - use). Passes including
+ * this file should not include DFAFramework.cpp themselves.
+ */
+class ForwardAnalysis : public DFAFramework<BitVector> {
+public:
+
+  ForwardAnalysis(bool intersect) : DFAFramework<BitVector>(true), intersect(intersect), entryBlock(NULL) {}
+
+  // Entry point for clients, the flow values need the entry block
+  void run(Function &F) {
+    entryBlock = &F.getEntryBlock();
+    analyze(F);
+  }
+
+  /**
+   * Fills the gen and kill sets of a single instruction.
+   * Both come in cleared and sized to the value index map.
+   */
+  virtual void instructionGenKill(Instruction *I, BitVector &gen, BitVector &kill) = 0;
+
+  /**
+   * Called before any gen or kill set is asked for, once the
+   * value index map is there.
+   */
+  virtual void initializeKillSets(Function &F) {}
+
+  // out[Block] = def[Block] U (in[Block] - use[Block])
+  virtual void transferFunction(BasicBlock* block) {
+    BitVector out = *(blockFlowDataMap[block]->use);
+    out.flip();
+    out &= *(blockFlowDataMap[block]->in);
+    out |= *(blockFlowDataMap[block]->def);
+    *(blockFlowDataMap[block]->out) = out;
+  }
+
+  // in[Block] = U or ^ out[Pred]. Blocks without predecessors
+  // keep the value set by setBoundaryConditions.
+  virtual void meet(BasicBlock* block) {
+    if (block == entryBlock || pred_begin(block) == pred_end(block))
+      return;
+    BitVector *in = blockFlowDataMap[block]->in;
+    bool first = true;
+    for (pred_iterator PI = pred_begin(block), E = pred_end(block); PI != E; ++PI) {
+      BitVector *predOut = blockFlowDataMap[*PI]->out;
+      if (first)
+        *in = *predOut;
+      else if (intersect)
+        *in &= *predOut;
+      else
+        *in |= *predOut;
+      first = false;
+    }
+  }
+
+  /**
+   * Replaces the liveness use and def sets of DFAFramework by
+   * kill and gen sets, per instruction and composed per block.
+   * With an intersection meet every out set starts out full.
+   */
+  virtual void setInitialFlowValues() {
+    Function &F = *entryBlock->getParent();
+    unsigned size = valueIndexMap.size();
+    initializeKillSets(F);
+
+    for (Function::iterator b = F.begin(), be = F.end(); b != be; b++) {
+      BasicBlockAnalysisData<BitVector> *blockData = blockFlowDataMap[b];
+      BitVector gen(size), kill(size);
+      for (BasicBlock::iterator i = b->begin(), ie = b->end(); i != ie; i++) {
+        InstructionAnalysisData<BitVector> *insData = instructionFlowDataMap[i];
+        insData->def->reset();
+        insData->use->reset();
+        instructionGenKill(i, *insData->def, *insData->use);
+
+        //A later kill removes an earlier gen and the other way round
+        BitVector notKilled = *insData->use;
+        notKilled.flip();
+        gen &= notKilled;
+        gen |= *insData->def;
+        kill |= *insData->use;
+        BitVector notGen = *insData->def;
+        notGen.flip();
+        kill &= notGen;
+      }
+      *blockData->def = gen;
+      *blockData->use = kill;
+      blockData->in->reset();
+      if (intersect)
+        blockData->out->set();
+      else
+        blockData->out->reset();
+    }
+  }
+
+  // Nothing flows into the entry block
+  virtual void setBoundaryConditions() {
+    blockFlowDataMap[entryBlock]->in->reset();
+  }
+
+  void pushResultsFromBlockToInstructions(ValueMap<BasicBlock*, BasicBlockAnalysisData<BitVector>*> &blockFlowDataMap,ValueMap<Value*, InstructionAnalysisData<BitVector>*> &instructionFlowDataMap) {
+    for (ValueMap<BasicBlock*, BasicBlockAnalysisData<BitVector>*>::iterator it = blockFlowDataMap.begin(), ite = blockFlowDataMap.end(); it != ite; it++) {
+      BasicBlock *B = it->first;
+      BitVector flow = *(it->second->in);
+      for (BasicBlock::iterator I = B->begin(), Ie = B->end(); I != Ie; ++I) {
+        InstructionAnalysisData<BitVector> *insData = instructionFlowDataMap[I];
+        *(insData->in) = flow;
+        BitVector notKilled = *(insData->use);
+        notKilled.flip();
+        flow &= notKilled;
+        flow |= *(insData->def);
+        *(insData->out) = flow;
+      }
+    }
+  }
+
+  // No phi masks going forward
+  void initializePHINodeMaskValues(map<pair<BasicBlock*, BasicBlock*>, BitVector*> &phiNodeMask,ValueMap<BasicBlock*, BasicBlockAnalysisData<BitVector>*> &blockFlowDataMap,ValueMap<Value *, int> &valueIndexMap,Function &F) {}
+
+  virtual void printFlowValue(BitVector *bv, bool newLine) {
+    for (unsigned bit = 0; bit < bv->size(); bit++)
+      errs() << (bv->test(bit) ? '1' : '0');
+    if(newLine) errs() << "\n";
+  }
+
+  virtual void printValuesInFormat() {
+    printIndexValueMap(valueIndexMap);
+    printBlockFlowDataMap(blockFlowDataMap);
+  }
+
+  // Bit of V in the flow values, -1 if V is not in the function
+  int getBit(Value *V) {
+    ValueMap<Value *, int>::iterator it = valueIndexMap.find(V);
+    if (it == valueIndexMap.end())
+      return -1;
+    return it->second;
+  }
+
+  // Check if the given bit is set on entry to I
+  bool testIn(Instruction *I, int bit) {
+    ValueMap<Value*, InstructionAnalysisData<BitVector>*>::iterator it = instructionFlowDataMap.find(I);
+    if (bit < 0 || it == instructionFlowDataMap.end())
+      return false;
+    return it->second->in->test(bit);
+  }
+
+protected:
+  bool intersect;
+  BasicBlock *entryBlock;
+};
+
+
+/**
+ * Reaching definitions. Every argument and instruction with a
+ * result is a definition that SSA never kills. A store defines
+ * the memory at its pointer operand and kills the other stores
+ * to the very same pointer value.
+ */
+class ReachingDefinitions : public ForwardAnalysis {
+public:
+
+  ReachingDefinitions() : ForwardAnalysis(false) {}
+
+  virtual void initializeKillSets(Function &F) {
+    storesTo.clear();
+    for (inst_iterator i = inst_begin(F), e = inst_end(F); i != e; i++)
+      if (StoreInst *SI = dyn_cast<StoreInst>(&*i)) {
+        BitVector &stores = storesTo[SI->getPointerOperand()];
+        stores.resize(valueIndexMap.size());
+        stores.set(valueIndexMap[SI]);
+      }
+  }
+
+  virtual void instructionGenKill(Instruction *I, BitVector &gen, BitVector &kill) {
+    if (StoreInst *SI = dyn_cast<StoreInst>(I)) {
+      kill = storesTo[SI->getPointerOperand()];
+      kill.reset(valueIndexMap[I]);
+      gen.set(valueIndexMap[I]);
+    }
+    else if (!I->getType()->isVoidTy())
+      gen.set(valueIndexMap[I]);
+  }
+
+  // Arguments are defined on entry
+  virtual void setBoundaryConditions() {
+    BitVector *in = blockFlowDataMap[entryBlock]->in;
+    in->reset();
+    Function *F = entryBlock->getParent();
+    for (Function::arg_iterator arg = F->arg_begin(), arge = F->arg_end(); arg != arge; arg++)
+      in->set(valueIndexMap[&*arg]);
+  }
+
+  // Check if Def reaches the point just before At
+  bool reaches(Value *Def, Instruction *At) {
+    return testIn(At, getBit(Def));
+  }
+
+  // Stores to the pointer of Load that reach it
+  void getReachingStores(LoadInst *Load, SmallVectorImpl<StoreInst*> &Stores) {
+    map<Value*, BitVector>::iterator it = storesTo.find(Load->getPointerOperand());
+    if (it == storesTo.end())
+      return;
+    for (ValueMap<Value *, int>::iterator v = valueIndexMap.begin(), ve = valueIndexMap.end(); v != ve; v++)
+      if (it->second.test(v->second) && testIn(Load, v->second))
+        Stores.push_back(cast<StoreInst>(v->first));
+  }
+
+private:
+  //Stores per pointer operand
+  map<Value*, BitVector> storesTo;
+};
+
+
+/**
+ * Available expressions. Instructions computing the same pure
+ * expression (opcode, type, operands, compare predicate) share
+ * the bit of the first of them. Operands are SSA values, so an
+ * expression is never killed once computed; the meet is an
+ * intersection over the predecessors.
+ */
+class AvailableExpressions : public ForwardAnalysis {
+public:
+
+  AvailableExpressions() : ForwardAnalysis(true) {}
+
+  static bool isExpression(Instruction *I) {
+    return isa<BinaryOperator>(I) || isa<CmpInst>(I) || isa<CastInst>(I) || isa<GetElementPtrInst>(I) || isa<SelectInst>(I);
+  }
+
+  virtual void initializeKillSets(Function &F) {
+    representative.clear();
+    map<ExpressionKey, Instruction*> firstOf;
+    for (inst_iterator i = inst_begin(F), e = inst_end(F); i != e; i++) {
+      Instruction *I = &*i;
+      if (!isExpression(I))
+        continue;
+      ExpressionKey key = getKey(I);
+      map<ExpressionKey, Instruction*>::iterator it = firstOf.find(key);
+      if (it == firstOf.end())
+        it = firstOf.insert(make_pair(key, I)).first;
+      representative[I] = it->second;
+    }
+  }
+
+  virtual void instructionGenKill(Instruction *I, BitVector &gen, BitVector &kill) {
+    if (Instruction *R = getRepresentative(I))
+      gen.set(valueIndexMap[R]);
+  }
+
+  // First instruction of the function computing the same expression as I
+  Instruction* getRepresentative(Instruction *I) {
+    map<Instruction*, Instruction*>::iterator it = representative.find(I);
+    return it == representative.end() ? NULL : it->second;
+  }
+
+  // Check if the expression of I is computed on every path to I
+  bool isAvailable(Instruction *I) {
+    Instruction *R = getRepresentative(I);
+    return R && testIn(I, getBit(R));
+  }
+
+  // Check if the expression of I is computed on every path to the end of BB
+  bool isAvailableAtEnd(Instruction *I, BasicBlock *BB) {
+    Instruction *R = getRepresentative(I);
+    return R && blockFlowDataMap[BB]->out->test(getBit(R));
+  }
+
+  typedef pair<pair<unsigned, Type*>, vector<Value*> > ExpressionKey;
+
+  // Instructions with equal keys compute the same value
+  static ExpressionKey getKey(Instruction *I) {
+    unsigned opcode = I->getOpcode() << 8;
+    if (CmpInst *CI = dyn_cast<CmpInst>(I))
+      opcode |= CI->getPredicate();
+    vector<Value*> operands(I->op_begin(), I->op_end());
+    if (I->isCommutative())
+      std::sort(operands.begin(), operands.end());
+    return make_pair(make_pair(opcode, I->getType()), operands);
+  }
+
+private:
+  map<Instruction*, Instruction*> representative;
+};
@@ -0,0 +1,68 @@
+/**
+ * Three level lattice used by the sparse analyses. A value
+ * starts out undefined (nothing known yet), may become a
+ * single constant of type T and ends up overdefined once two
+ * different constants meet. Like the flow values of the DFA
+ * framework a value only ever moves down, so a worklist
+ * solver over it terminates.
+ */
+template<class T>
+class LatticeValue {
+public:
+  enum State { Undefined, ConstantValue, Overdefined };
+
+  LatticeValue() : state(Undefined), value() {}
+
+  static LatticeValue getConstant(T v) {
+    LatticeValue result;
+    result.state = ConstantValue;
+    result.value = v;
+    return result;
+  }
+
+  static LatticeValue getOverdefined() {
+    LatticeValue result;
+    result.state = Overdefined;
+    return result;
+  }
+
+  bool isUndefined() const { return state == Undefined; }
+  bool isConstant() const { return state == ConstantValue; }
+  bool isOverdefined() const { return state == Overdefined; }
+
+  T getValue() const { return value; }
+
+  /**
+   * Lowers this value to its meet with other.
+   * Returns true if this value changed.
+   */
+  bool meet(const LatticeValue &other) {
+    if (other.state == Undefined || state == Overdefined)
+      return false;
+    if (other.state == Overdefined)
+      return markOverdefined();
+    if (state == Undefined) {
+      state = ConstantValue;
+      value = other.value;
+      return true;
+    }
+    if (value == other.value)
+      return false;
+    return markOverdefined();
+  }
+
+  bool markOverdefined() {
+    if (state == Overdefined)
+      return false;
+    state = Overdefined;
+    return true;
+  }
+
+  bool operator!=(const LatticeValue &other) const {
+    return state != other.state || (state == ConstantValue && value != other.value);
+  }
+
+private:
+  State state;
+  T value;
+};
@@ -0,0 +1,75 @@
+#include "DFATemplate.cpp"
+
+/**
+ * Backward liveness analysis on top of DFATemplate.
+ * Shared by the passes that need to know which values
+ * are still live at the boundaries of a block or an
+ * instruction. Passes including this file should not
+ * include DFATemplate.cpp themselves.
+ */
+class LiveAnalysis : public DFATemplate<BitVector> {
+public:
+
+  LiveAnalysis() : DFATemplate<BitVector>(false){}
+
+  // in[Block] = use[Block] U (out[Block] - def[Block])
+  virtual void flowFunction(BasicBlock* block)
+  {
+    BitVector bdef = *(flowForBB[block]->def);
+    BitVector bin = *(flowForBB[block]->use);
+    bdef.flip();
+    bdef &= *(flowForBB[block]->out);
+
+    bin |= bdef;
+    *(flowForBB[block]->in) = bin;
+  }
+
+  // out[Block] = U in[Succ], masking the phi operands that
+  // flow in from the other predecessors of Succ
+  virtual void merge(BasicBlock* block)
+  {
+    (flowForBB[block]->out)->reset();
+
+    for (succ_iterator next = succ_begin(block),nexte = succ_end(block); next != nexte; next++) {
+      BasicBlock* succ = *next;
+      pair<BasicBlock *, BasicBlock *> phiNodePair= make_pair(block, succ);
+
+      if (flowForPhiNode.find(phiNodePair) != flowForPhiNode.end())
+      {
+        BitVector phiFlow = *(flowForBB[succ]->in);
+        phiFlow &= *(flowForPhiNode[phiNodePair]);
+        *(flowForBB[block]->out) |= phiFlow;
+      }
+      else
+        *(flowForBB[block]->out) |= *(flowForBB[succ]->in);
+    }
+  }
+
+  // Check if V is live on entry to the given block
+  bool isLiveIn(Value *V, BasicBlock *block)
+  {
+    ValueMap<Value *,int>::iterator it = mapValueToBit.find(V);
+    if (it == mapValueToBit.end())
+      return false;
+    return flowForBB[block]->in->test(it->second);
+  }
+
+  // Check if V is live just before I
+  bool isLiveBefore(Value *V, Instruction *I)
+  {
+    ValueMap<Value *,int>::iterator it = mapValueToBit.find(V);
+    if (it == mapValueToBit.end())
+      return false;
+    return flowForIns[I]->in->test(it->second);
+  }
+
+  // Check if V is live just after I
+  bool isLiveAfter(Value *V, Instruction *I)
+  {
+    ValueMap<Value *,int>::iterator it = mapValueToBit.find(V);
+    if (it == mapValueToBit.end())
+      return false;
+    return flowForIns[I]->out->test(it->second);
+  }
+
+};
@@ -0,0 +1,247 @@
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/ValueMap.h"
+#include "llvm/Assembly/Writer.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <vector>
+
+using namespace llvm;
+using namespace std;
+
+/**
+ * Live intervals built from solved liveness block sets.
+ * Instructions are numbered in layout order and every
+ * instruction k has two slots: 2k just before it and 2k+1
+ * just after it. A value is described by the sorted list
+ * of half open slot ranges in which it is live, so a whole
+ * function takes a few words per live range instead of
+ * four bit vectors per instruction.
+ */
+class LiveIntervals {
+public:
+
+  struct Segment {
+    unsigned start;
+    unsigned end;
+    Value *value;
+  };
+
+  /**
+   * Walks every block backward once from its live out set.
+   * BlockData is the block flow data of either framework,
+   * only its in and out vectors are read.
+   */
+  template<class BlockData>
+  void build(Function &F, ValueMap<Value *, int> &valueIndexMap, ValueMap<BasicBlock*, BlockData*> &blockFlowData) {
+    clear();
+    unsigned numValues = valueIndexMap.size();
+    vector<Value*> valueOf(numValues);
+    for (ValueMap<Value *, int>::iterator it = valueIndexMap.begin(), ite = valueIndexMap.end(); it != ite; ++it)
+      valueOf[it->second] = it->first;
+
+    unsigned number = 0;
+    for (Function::iterator b = F.begin(), be = F.end(); b != be; b++) {
+      blockStart.push_back(2 * number);
+      blocks.push_back(b);
+      for (BasicBlock::iterator i = b->begin(), ie = b->end(); i != ie; ++i)
+        numbering[i] = number++;
+    }
+    blockStart.push_back(2 * number);
+
+    //End slot of the range each value has open while walking up
+    vector<int> openEnd(numValues, -1);
+    SmallVector<unsigned, 32> open;
+    vector<pair<unsigned, Segment> > found;
+    for (unsigned n = 0, ne = blocks.size(); n != ne; ++n) {
+      BasicBlock *BB = blocks[n];
+      BitVector *out = blockFlowData[BB]->out;
+      open.clear();
+      for (int bit = out->find_first(); bit != -1; bit = out->find_next(bit)) {
+        openEnd[bit] = blockStart[n + 1];
+        open.push_back(bit);
+      }
+
+      for (BasicBlock::reverse_iterator I = BB->rbegin(), IE = BB->rend(); I != IE; ++I) {
+        unsigned k = numbering[&*I];
+        ValueMap<Value *, int>::iterator def = valueIndexMap.find(&*I);
+        if (def != valueIndexMap.end() && openEnd[def->second] != -1) {
+          addSegment(found, def->second, 2 * k + 1, openEnd[def->second], &*I);
+          openEnd[def->second] = -1;
+        }
+        //Phi operands are live on the incoming edges, not here
+        if (isa<PHINode>(&*I))
+          continue;
+        for (User::op_iterator OI = I->op_begin(), OE = I->op_end(); OI != OE; ++OI) {
+          ValueMap<Value *, int>::iterator use = valueIndexMap.find(*OI);
+          if (use == valueIndexMap.end() || openEnd[use->second] != -1)
+            continue;
+          openEnd[use->second] = 2 * k + 1;
+          open.push_back(use->second);
+        }
+      }
+
+      //What is still open is live into the block
+      for (unsigned i = 0, e = open.size(); i != e; ++i)
+        if (openEnd[open[i]] != -1) {
+          addSegment(found, open[i], blockStart[n], openEnd[open[i]], valueOf[open[i]]);
+          openEnd[open[i]] = -1;
+        }
+    }
+
+    finish(found);
+  }
+
+  void clear() {
+    numbering.clear();
+    blocks.clear();
+    blockStart.clear();
+    segments.clear();
+    ranges.clear();
+    byStart.clear();
+    liveIn.clear();
+    liveInBegin.clear();
+  }
+
+  // Number of I in the layout order, its slots are twice that and one more
+  unsigned getNumber(const Instruction *I) {
+    return numbering.lookup(I);
+  }
+
+  static unsigned getSlotBefore(unsigned number) { return 2 * number; }
+  static unsigned getSlotAfter(unsigned number) { return 2 * number + 1; }
+
+  // The live ranges of V, sorted by start
+  const Segment *begin(Value *V) {
+    DenseMap<Value*, pair<unsigned, unsigned> >::iterator it = ranges.find(V);
+    return it == ranges.end() ? NULL : &segments[it->second.first];
+  }
+
+  const Segment *end(Value *V) {
+    DenseMap<Value*, pair<unsigned, unsigned> >::iterator it = ranges.find(V);
+    return it == ranges.end() ? NULL : &segments[0] + it->second.second;
+  }
+
+  // Binary search of the ranges of V for slot
+  bool isLiveAt(Value *V, unsigned slot) {
+    const Segment *first = begin(V), *last = end(V);
+    if (first == last)
+      return false;
+    const Segment *after = std::upper_bound(first, last, slot, startsAfter);
+    return after != first && (after - 1)->end > slot;
+  }
+
+  /**
+   * Appends the values live at slot. Only the ranges live into
+   * the block of slot and the ones starting in it before slot
+   * are looked at, not the other values of the function.
+   */
+  void getLiveAt(unsigned slot, SmallVectorImpl<Value*> &live) {
+    if (blocks.empty() || slot >= blockStart.back())
+      return;
+    unsigned n = std::upper_bound(blockStart.begin(), blockStart.end(), slot) - blockStart.begin() - 1;
+
+    for (unsigned i = liveInBegin[n], e = liveInBegin[n + 1]; i != e; ++i)
+      if (segments[liveIn[i]].end > slot)
+        live.push_back(segments[liveIn[i]].value);
+
+    vector<unsigned>::iterator it = std::lower_bound(byStart.begin(), byStart.end(), blockStart[n] + 1, StartsBefore(segments));
+    for (; it != byStart.end() && segments[*it].start <= slot; ++it)
+      if (segments[*it].end > slot)
+        live.push_back(segments[*it].value);
+  }
+
+  void print(raw_ostream &OS) {
+    for (unsigned i = 0, e = segments.size(); i != e; ) {
+      Value *V = segments[i].value;
+      OS << "  ";
+      WriteAsOperand(OS, V, false);
+      OS << ":";
+      for (; i != e && segments[i].value == V; ++i)
+        OS << " [" << segments[i].start << ", " << segments[i].end << ")";
+      OS << "\n";
+    }
+  }
+
+private:
+  DenseMap<const Instruction*, unsigned> numbering;
+  vector<BasicBlock*> blocks;
+  //First slot of every block, plus the end of the function
+  vector<unsigned> blockStart;
+  //Ranges grouped per value and sorted by start within a value
+  vector<Segment> segments;
+  DenseMap<Value*, pair<unsigned, unsigned> > ranges;
+  //Indices of segments ordered by start slot
+  vector<unsigned> byStart;
+  //Per block the indices of the segments live into it
+  vector<unsigned> liveIn;
+  vector<unsigned> liveInBegin;
+
+  static bool startsAfter(unsigned slot, const Segment &S) {
+    return slot < S.start;
+  }
+
+  // Orders found ranges by value index, then by start
+  static bool valueThenStart(const pair<unsigned, Segment> &A, const pair<unsigned, Segment> &B) {
+    if (A.first != B.first)
+      return A.first < B.first;
+    return A.second.start < B.second.start;
+  }
+
+  // Orders segment indices by start slot
+  struct StartLess {
+    const vector<Segment> &segments;
+    StartLess(const vector<Segment> &segments) : segments(segments) {}
+    bool operator()(unsigned A, unsigned B) const { return segments[A].start < segments[B].start; }
+  };
+
+  // Compares the start of a segment index with a slot
+  struct StartsBefore {
+    const vector<Segment> &segments;
+    StartsBefore(const vector<Segment> &segments) : segments(segments) {}
+    bool operator()(unsigned A, unsigned slot) const { return segments[A].start < slot; }
+  };
+
+  static void addSegment(vector<pair<unsigned, Segment> > &found, unsigned index, unsigned start, unsigned end, Value *V) {
+    Segment S = { start, end, V };
+    found.push_back(make_pair(index, S));
+  }
+
+  // Sorts and merges the ranges found per block and builds the
+  // indices for point queries
+  void finish(vector<pair<unsigned, Segment> > &found) {
+    std::sort(found.begin(), found.end(), valueThenStart);
+    for (unsigned i = 0, e = found.size(); i != e; ++i) {
+      Segment &S = found[i].second;
+      if (!segments.empty() && segments.back().value == S.value && segments.back().end >= S.start) {
+        segments.back().end = std::max(segments.back().end, S.end);
+        continue;
+      }
+      if (segments.empty() || segments.back().value != S.value)
+        ranges[S.value] = make_pair((unsigned)segments.size(), (unsigned)segments.size());
+      segments.push_back(S);
+      ranges[S.value].second = segments.size();
+    }
+
+    byStart.resize(segments.size());
+    for (unsigned i = 0, e = segments.size(); i != e; ++i)
+      byStart[i] = i;
+    std::sort(byStart.begin(), byStart.end(), StartLess(segments));
+
+    //A merged range may cover several blocks, it is live into each
+    vector<SmallVector<unsigned, 8> > into(blocks.size());
+    for (unsigned i = 0, e = segments.size(); i != e; ++i) {
+      unsigned n = std::lower_bound(blockStart.begin(), blockStart.end(), segments[i].start) - blockStart.begin();
+      for (; n < blocks.size() && blockStart[n] < segments[i].end; ++n)
+        into[n].push_back(i);
+    }
+    for (unsigned n = 0, ne = blocks.size(); n != ne; ++n) {
+      liveInBegin.push_back(liveIn.size());
+      liveIn.insert(liveIn.end(), into[n].begin(), into[n].end());
+    }
+    liveInBegin.push_back(liveIn.size());
+  }
+};
@@ -0,0 +1,54 @@
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+#include <string>
+
+using namespace llvm;
+
+/**
+ * A file a pass writes to when its option names one. The
+ * file is opened on first use, after the options were
+ * parsed, and an error is printed once if that fails. The
+ * name is not copied, it has to live as long as this does,
+ * which the string of a cl::opt does. Remarks.cpp and
+ * AnalysisExport.cpp both include this file, so a pass can
+ * include only one of them.
+ */
+class OutputFile {
+public:
+  OutputFile(const char *Pass, const char *Kind, const std::string &File, sys::fs::OpenFlags Flags)
+    : PassName(Pass), Kind(Kind), FileName(File), Flags(Flags), OS(0), triedOpen(false) {}
+
+  ~OutputFile() { delete OS; }
+
+  /**
+   * The open stream, or null when no file was named or it
+   * could not be opened.
+   */
+  raw_fd_ostream *get()
+  {
+    if (!triedOpen)
+    {
+      triedOpen = true;
+      if (!FileName.empty())
+      {
+        std::string ErrorInfo;
+        OS = new raw_fd_ostream(FileName.c_str(), ErrorInfo, Flags);
+        if (!ErrorInfo.empty())
+        {
+          errs() << PassName << ": can not open " << Kind << " file " << FileName << ": " << ErrorInfo << "\n";
+          delete OS;
+          OS = 0;
+        }
+      }
+    }
+    return OS;
+  }
+
+private:
+  const char *PassName;
+  const char *Kind;
+  const std::string &FileName;
+  sys::fs::OpenFlags Flags;
+  raw_fd_ostream *OS;
+  bool triedOpen;
+};
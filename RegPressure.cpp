@@ -0,0 +1,175 @@
+#include "LiveAnalysis.cpp"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/Type.h"
+
+/**
+ * Register pressure estimates on top of LiveAnalysis: the
+ * number of values live before an instruction, at the worst
+ * point of a block and at the worst point of a loop, split
+ * by register class. Counts are popcounts over the liveness
+ * bit vectors masked per class, so a query costs a few word
+ * operations. Results are cached for one function and have
+ * to be invalidated once its code changes. Passes including
+ * this file should not include LiveAnalysis.cpp themselves.
+ */
+class RegPressure {
+public:
+  enum RegClass { Integer, Float, Vector, NumRegClasses };
+
+  /**
+   * Live value counts, one per register class, and the count
+   * over all classes. After max() the class counts may come
+   * from different points, all is the most live at one point.
+   */
+  struct Pressure {
+    unsigned count[NumRegClasses];
+    unsigned all;
+
+    Pressure() : all(0) {
+      for (unsigned c = 0; c != NumRegClasses; ++c)
+        count[c] = 0;
+    }
+
+    unsigned operator[](RegClass c) const { return count[c]; }
+
+    unsigned total() const { return all; }
+
+    // Per class and overall maximum of the two
+    void max(const Pressure &other) {
+      for (unsigned c = 0; c != NumRegClasses; ++c)
+        if (other.count[c] > count[c])
+          count[c] = other.count[c];
+      if (other.all > all)
+        all = other.all;
+    }
+
+    bool operator<(const Pressure &other) const {
+      return all < other.all;
+    }
+
+    void print(raw_ostream &OS) const {
+      OS << all << " (int " << count[Integer] << ", float " << count[Float]
+         << ", vector " << count[Vector] << ")";
+    }
+  };
+
+  RegPressure() : cachedFunction(NULL) {}
+
+  static RegClass getRegClass(Type *Ty) {
+    if (Ty->isVectorTy())
+      return Vector;
+    if (Ty->isFloatingPointTy())
+      return Float;
+    return Integer;
+  }
+
+  /**
+   * Makes the results for F available, running the liveness
+   * analysis unless F is the function cached already.
+   */
+  void compute(Function &F) {
+    if (cachedFunction == &F)
+      return;
+    invalidate();
+    Live.runAnalysis(F);
+    cachedFunction = &F;
+
+    unsigned size = Live.mapValueToBit.size();
+    floatMask.clear();
+    floatMask.resize(size);
+    vectorMask.clear();
+    vectorMask.resize(size);
+    for (ValueMap<Value *,int>::iterator it = Live.mapValueToBit.begin(), ite = Live.mapValueToBit.end(); it != ite; ++it) {
+      RegClass c = getRegClass(it->first->getType());
+      if (c == Float)
+        floatMask.set(it->second);
+      else if (c == Vector)
+        vectorMask.set(it->second);
+    }
+  }
+
+  /**
+   * Drops every cached result, the next compute() runs the
+   * liveness analysis again.
+   */
+  void invalidate() {
+    cachedFunction = NULL;
+    blockPressure.clear();
+    loopPressure.clear();
+  }
+
+  LiveAnalysis &getLiveness() { return Live; }
+
+  // Live values per class in the given set. Values without a
+  // result never become live, so the rest of them are integers.
+  Pressure count(const BitVector &live) {
+    Pressure result;
+    scratch = live;
+    scratch &= floatMask;
+    result.count[Float] = scratch.count();
+    scratch = live;
+    scratch &= vectorMask;
+    result.count[Vector] = scratch.count();
+    result.all = live.count();
+    result.count[Integer] = result.all - result.count[Float] - result.count[Vector];
+    return result;
+  }
+
+  // Values live just before I, nothing for code made after compute()
+  Pressure getInstructionPressure(Instruction *I) {
+    ValueMap<Value*, InsNode<BitVector>*>::iterator it = Live.flowForIns.find(I);
+    if (it == Live.flowForIns.end())
+      return Pressure();
+    return count(*(it->second->in));
+  }
+
+  // Most values live at any point of BB
+  Pressure getBlockPressure(BasicBlock *BB) {
+    map<BasicBlock*, Pressure>::iterator it = blockPressure.find(BB);
+    if (it != blockPressure.end())
+      return it->second;
+
+    Pressure result;
+    ValueMap<BasicBlock*, BBNode<BitVector>*>::iterator flow = Live.flowForBB.find(BB);
+    if (flow != Live.flowForBB.end())
+      result = count(*(flow->second->out));
+    for (BasicBlock::iterator i = BB->begin(), ie = BB->end(); i != ie; ++i)
+      result.max(getInstructionPressure(i));
+    return blockPressure[BB] = result;
+  }
+
+  // Most values live at any point of L
+  Pressure getLoopPressure(Loop *L) {
+    map<Loop*, Pressure>::iterator it = loopPressure.find(L);
+    if (it != loopPressure.end())
+      return it->second;
+
+    Pressure result;
+    for (Loop::block_iterator b = L->block_begin(), be = L->block_end(); b != be; ++b)
+      result.max(getBlockPressure(*b));
+    return loopPressure[L] = result;
+  }
+
+  /**
+   * Accounts for a new value of type Ty that is live across
+   * all of L, such as one hoisted out of it, without running
+   * the analysis again. Cached loops inside L see it.
+   */
+  void noteLiveAcross(Loop *L, Type *Ty) {
+    RegClass c = getRegClass(Ty);
+    for (map<Loop*, Pressure>::iterator it = loopPressure.begin(), ite = loopPressure.end(); it != ite; ++it)
+      if (L->contains(it->first)) {
+        it->second.count[c]++;
+        it->second.all++;
+      }
+  }
+
+private:
+  LiveAnalysis Live;
+  Function *cachedFunction;
+  BitVector floatMask;
+  BitVector vectorMask;
+  BitVector scratch;
+  map<BasicBlock*, Pressure> blockPressure;
+  map<Loop*, Pressure> loopPressure;
+};
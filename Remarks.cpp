@@ -0,0 +1,147 @@
+#include "llvm/IR/Function.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Instruction.h"
+#include "llvm/DebugInfo.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+#include "OutputFile.cpp"
+#include <map>
+#include <string>
+
+using namespace llvm;
+
+/**
+ * Optimization remarks of one pass, written as a stream of YAML
+ * documents to the file named by the pass option. Every remark is
+ * also counted per loop and per function, the counts are written
+ * as summary remarks when the pass asks for them.
+ */
+class RemarkEmitter {
+public:
+  enum RemarkKind { Passed, Missed, Analysis };
+
+  RemarkEmitter(const char *Pass, const std::string &File)
+    : PassName(Pass), Output(Pass, "remarks", File, sys::fs::F_None), OS(0) {}
+
+  /**
+   * Remarks are on when a file name was given and it could be opened.
+   */
+  bool enabled()
+  {
+    OS = Output.get();
+    return OS != 0;
+  }
+
+  /**
+   * Emits a remark of the given kind about I. L is the loop the remark
+   * belongs to and may be null.
+   */
+  void remark(RemarkKind Kind, const char *Name, Instruction *I, Loop *L, const Twine &Message)
+  {
+    if (!enabled())
+      return;
+    ++LoopCounts[Name];
+    ++FunctionCounts[Name];
+
+    writeHeader(Kind, Name);
+    writeDebugLoc(I);
+    writeField("Function", I->getParent()->getParent()->getName());
+    if (L)
+      writeField("Loop", L->getHeader()->getName());
+    writeField("Message", Message.str());
+    *OS << "...\n";
+  }
+
+  /**
+   * Emits the counts of the remarks made since the last loop summary.
+   */
+  void emitLoopSummary(Loop *L)
+  {
+    if (!enabled())
+      return;
+    writeHeader(Analysis, "LoopSummary");
+    writeField("Function", L->getHeader()->getParent()->getName());
+    writeField("Loop", L->getHeader()->getName());
+    writeCounts(LoopCounts);
+    LoopCounts.clear();
+  }
+
+  /**
+   * Emits the counts of the remarks made in F and starts over.
+   */
+  void emitFunctionSummary(Function &F)
+  {
+    if (!enabled())
+      return;
+    writeHeader(Analysis, "FunctionSummary");
+    writeField("Function", F.getName());
+    writeCounts(FunctionCounts);
+    FunctionCounts.clear();
+    LoopCounts.clear();
+    OS->flush();
+  }
+
+private:
+  const char *PassName;
+  OutputFile Output;
+  raw_fd_ostream *OS;
+  std::map<std::string, unsigned> LoopCounts;
+  std::map<std::string, unsigned> FunctionCounts;
+
+  void writeHeader(RemarkKind Kind, const char *Name)
+  {
+    switch (Kind) {
+      case Passed:   *OS << "--- !Passed\n"; break;
+      case Missed:   *OS << "--- !Missed\n"; break;
+      case Analysis: *OS << "--- !Analysis\n"; break;
+    }
+    writeField("Pass", PassName);
+    writeField("Name", Name);
+  }
+
+  void writeField(const char *Key, StringRef Value)
+  {
+    *OS << Key << ": ";
+    writeString(Value);
+    *OS << "\n";
+  }
+
+  // Single quoted YAML scalar, quotes inside are doubled
+  void writeString(StringRef Value)
+  {
+    *OS << '\'';
+    for (unsigned i = 0, e = Value.size(); i != e; ++i)
+    {
+      if (Value[i] == '\'')
+        *OS << '\'';
+      *OS << Value[i];
+    }
+    *OS << '\'';
+  }
+
+  void writeDebugLoc(Instruction *I)
+  {
+    DebugLoc DL = I->getDebugLoc();
+    if (DL.isUnknown())
+      return;
+    DIScope Scope(DL.getScope(I->getContext()));
+    *OS << "DebugLoc: { File: ";
+    writeString(Scope.getFilename());
+    *OS << ", Line: " << DL.getLine() << ", Column: " << DL.getCol() << " }\n";
+  }
+
+  void writeCounts(std::map<std::string, unsigned> &Counts)
+  {
+    if (Counts.empty())
+    {
+      *OS << "Counts: {}\n...\n";
+      return;
+    }
+    *OS << "Counts:\n";
+    for (std::map<std::string, unsigned>::iterator it = Counts.begin(), ite = Counts.end(); it != ite; ++it)
+      *OS << "  " << it->first << ": " << it->second << "\n";
+    *OS << "...\n";
+  }
+};
@@ -0,0 +1,199 @@
+#include "llvm/Pass.h"
+#include "llvm/Support/CFG.h"
+#include "llvm/Support/InstIterator.h"
+#include "llvm/PassManager.h"
+#include "llvm/Transforms/IPO/PassManagerBuilder.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/ValueMap.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Analysis/Dominators.h"
+#include "ForwardAnalyses.cpp"
+#include <map>
+#include <vector>
+#include <algorithm>
+
+using namespace llvm;
+using namespace std;
+
+STATISTIC(NumCSE, "Number of redundant instructions replaced by a dominating one");
+STATISTIC(NumCSEPhi, "Number of instructions replaced by a phi of values computed on every path");
+
+static cl::opt<bool> UseAvailability("cse-avail", cl::init(false),
+  cl::desc("Also replace expressions computed on every incoming path of a join by a phi"));
+
+namespace {
+
+  // Dominator tree scoped value numbering. Pure instructions get the
+  // number of (opcode, type, flags, operand numbers); an instruction
+  // whose number already has a dominating leader is replaced by it.
+  class CSE : public FunctionPass {
+  public:
+    static char ID;
+    CSE() : FunctionPass(ID) {}
+
+  private:
+    typedef pair<pair<unsigned, Type*>, vector<unsigned> > ExpressionKey;
+
+    DominatorTree *DT;
+    bool changed;
+    unsigned nextValueNumber;
+    map<Value*, unsigned> valueNumbers;
+    map<ExpressionKey, unsigned> expressionNumbers;
+    //Leader of each value number in the current dominator tree scope
+    map<unsigned, Instruction*> leaders;
+
+    virtual bool runOnFunction(Function &F) {
+      DT = &getAnalysis<DominatorTree>();
+      changed = false;
+      nextValueNumber = 0;
+      valueNumbers.clear();
+      expressionNumbers.clear();
+      leaders.clear();
+
+      ValueNumberRegion(DT->getRootNode());
+
+      if (UseAvailability)
+        eliminateAcrossJoins(F);
+      return changed;
+    }
+
+    virtual void getAnalysisUsage(AnalysisUsage &AU) const {
+      AU.setPreservesCFG();
+      AU.addRequired<DominatorTree>();
+    }
+
+    static bool isCandidate(Instruction *I) {
+      return AvailableExpressions::isExpression(I);
+    }
+
+    unsigned getValueNumber(Value *V) {
+      map<Value*, unsigned>::iterator it = valueNumbers.find(V);
+      if (it != valueNumbers.end())
+        return it->second;
+      return valueNumbers[V] = nextValueNumber++;
+    }
+
+    // Operands dominate their users, so they are numbered already
+    // unless they are not candidates themselves
+    unsigned numberInstruction(Instruction *I) {
+      if (!isCandidate(I))
+        return getValueNumber(I);
+
+      unsigned opcode = I->getOpcode() << 16 | I->getRawSubclassOptionalData();
+      if (CmpInst *CI = dyn_cast<CmpInst>(I))
+        opcode |= CI->getPredicate() << 8;
+      vector<unsigned> operands;
+      for (User::op_iterator OI = I->op_begin(), OE = I->op_end(); OI != OE; ++OI)
+        operands.push_back(getValueNumber(*OI));
+      if (I->isCommutative())
+        std::sort(operands.begin(), operands.end());
+
+      ExpressionKey key = make_pair(make_pair(opcode, I->getType()), operands);
+      map<ExpressionKey, unsigned>::iterator it = expressionNumbers.find(key);
+      unsigned number;
+      if (it != expressionNumbers.end())
+        number = it->second;
+      else
+        number = expressionNumbers[key] = nextValueNumber++;
+      return valueNumbers[I] = number;
+    }
+
+    // Preorder walk of the dominator tree, the leaders found in a block
+    // go out of scope once its dominated blocks are done
+    void ValueNumberRegion(DomTreeNode *N) {
+      BasicBlock *BB = N->getBlock();
+      vector<unsigned> scope;
+
+      for (BasicBlock::iterator II = BB->begin(), E = BB->end(); II != E; ) {
+        Instruction *I = II++;
+        unsigned number = numberInstruction(I);
+        if (!isCandidate(I))
+          continue;
+
+        map<unsigned, Instruction*>::iterator it = leaders.find(number);
+        if (it != leaders.end()) {
+          I->replaceAllUsesWith(it->second);
+          //The address may come back for an instruction made later
+          valueNumbers.erase(I);
+          I->eraseFromParent();
+          ++NumCSE;
+          changed = true;
+          continue;
+        }
+        leaders[number] = I;
+        scope.push_back(number);
+      }
+
+      const std::vector<DomTreeNode*> &Children = N->getChildren();
+      for (unsigned i = 0, e = Children.size(); i != e; ++i)
+        ValueNumberRegion(Children[i]);
+
+      for (unsigned i = 0, e = scope.size(); i != e; ++i)
+        leaders.erase(scope[i]);
+    }
+
+    // An instruction with the same number that is there at the end of Pred
+    Instruction* findOnEdge(vector<Instruction*> &sameNumber, Instruction *I, BasicBlock *Pred) {
+      for (unsigned i = 0, e = sameNumber.size(); i != e; ++i)
+        if (sameNumber[i] != I && DT->dominates(sameNumber[i], Pred->getTerminator()))
+          return sameNumber[i];
+      return NULL;
+    }
+
+    // An expression computed on every path into a join, without a single
+    // dominating computation, is replaced by a phi of the per path values.
+    // AvailableExpressions tells which instructions are worth the search.
+    void eliminateAcrossJoins(Function &F) {
+      AvailableExpressions Avail;
+      Avail.run(F);
+
+      map<unsigned, vector<Instruction*> > withNumber;
+      for (inst_iterator i = inst_begin(F), e = inst_end(F); i != e; i++)
+        if (isCandidate(&*i) && valueNumbers.count(&*i))
+          withNumber[valueNumbers[&*i]].push_back(&*i);
+
+      for (Function::iterator b = F.begin(), be = F.end(); b != be; b++) {
+        BasicBlock *BB = b;
+        if (BB->getSinglePredecessor() || pred_begin(BB) == pred_end(BB))
+          continue;
+
+        for (BasicBlock::iterator II = BB->begin(), E = BB->end(); II != E; ) {
+          Instruction *I = II++;
+          if (!isCandidate(I) || !valueNumbers.count(I) || !Avail.isAvailable(I))
+            continue;
+
+          vector<Instruction*> &sameNumber = withNumber[valueNumbers[I]];
+          SmallVector<pair<Instruction*, BasicBlock*>, 4> incoming;
+          bool everyPath = true;
+          for (pred_iterator PI = pred_begin(BB), PE = pred_end(BB); PI != PE && everyPath; ++PI) {
+            Instruction *J = findOnEdge(sameNumber, I, *PI);
+            if (J)
+              incoming.push_back(make_pair(J, *PI));
+            everyPath = J != NULL;
+          }
+          if (!everyPath)
+            continue;
+
+          PHINode *PN = PHINode::Create(I->getType(), incoming.size(), I->getName() + ".cse", BB->begin());
+          for (unsigned i = 0, e = incoming.size(); i != e; ++i)
+            PN->addIncoming(incoming[i].first, incoming[i].second);
+          I->replaceAllUsesWith(PN);
+          sameNumber.erase(std::find(sameNumber.begin(), sameNumber.end(), I));
+          valueNumbers.erase(I);
+          I->eraseFromParent();
+          ++NumCSEPhi;
+          changed = true;
+        }
+      }
+    }
+  };
+
+char CSE::ID = 0;
+RegisterPass<CSE> X("cse-pass", "CSE Pass");
+}
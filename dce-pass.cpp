@@ -19,8 +19,12 @@
 #include "llvm/Analysis/ValueTracking.h"
 #include "llvm/ADT/Statistic.h"
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/Analysis/Dominators.h"
+#include "llvm/Support/CommandLine.h"
 #include "DFATemplate.cpp"
+#include "CFGCleanup.cpp"
+#include "Remarks.cpp"
 #include <map>
 #include <set>
 #include <ostream>
@@ -31,16 +35,25 @@
 using namespace llvm;
 using namespace std;
 
+static cl::opt<bool> CleanupCFG("dce-cfg-cleanup", cl::init(true),
+  cl::desc("Remove unreachable blocks, fold constant branches and merge block chains after DCE"));
+
+static cl::opt<std::string> DCERemarksFile("dce-remarks-file", cl::init(""),
+  cl::desc("Write the optimization remarks of dce-pass to this file as YAML"));
+
 namespace {
 
   class FunctionInfo : public FunctionPass, public DFATemplate<BitVector> {
 
   public:
     static char ID;
-    FunctionInfo() : FunctionPass(ID), DFATemplate(false){}
+    FunctionInfo() : FunctionPass(ID), DFATemplate(false), Remarks("dce-pass", DCERemarksFile){}
     LoopInfo* LI;
     DominatorTree* DT; 
     Loop* CurrentLoop;
+    RemarkEmitter Remarks;
+    //Upper bound on the size of a phi web we are willing to explore
+    static const unsigned MaxPHIWebSize = 64;
    
     virtual void flowFunction(BasicBlock* block)
     {
@@ -81,7 +94,10 @@ namespace {
        LI = &getAnalysis<LoopInfo>();
        DT = &getAnalysis<DominatorTree>();
       vector<Instruction*> editlist;
+      bool modified = false;
       int change = 0;
+      //A blocked instruction is met again on every sweep, report it once
+      SmallPtrSet<Instruction*, 8> reportedMissed;
       do
       {
         //errs()<<"Entered again\n";
@@ -155,7 +171,13 @@ namespace {
  
 
          if(k==0)
-         break;
+         {
+           if (reportedMissed.insert(i))
+             Remarks.remark(RemarkEmitter::Missed, "NotDeleted", i, CurrentLoop,
+                            "dead but a use is not dominated by its definition");
+           break;
+         }
+         Remarks.remark(RemarkEmitter::Passed, "Deleted", i, CurrentLoop, "dead instruction removed");
 
 
 
@@ -164,21 +186,105 @@ namespace {
          i->removeFromParent();
          //editlist.push_back(i);
          change = 1;
+         modified = true;
          runAnalysis(F);
         
 
         }
       
         }
-  
+
+        //Liveness keeps loop carried values alive through the back edge,
+        //so phi cycles are only caught once nothing else is left to remove
+        if (change == 0 && removeDeadPHICycles(F))
+        {
+          change = 1;
+          modified = true;
+          runAnalysis(F);
+        }
 
       }while(change==1);		      	 
 
-      return false;
+      //Dominator tree and loop info are not kept up to date past here
+      if (CleanupCFG)
+        modified |= cleanupCFG(F);
+
+      Remarks.emitFunctionSummary(F);
+      return modified;
+    }
+
+    // Collect the web of instructions reachable through the uses of PN.
+    // Returns false as soon as a use escapes the web, i.e. it is a
+    // terminator, has side effects or the web grows too large.
+    bool collectPHIWeb(PHINode *PN, SmallPtrSet<Instruction*, 16> &Web)
+    {
+      SmallVector<Instruction*, 16> workList;
+      Web.insert(PN);
+      workList.push_back(PN);
+
+      while (!workList.empty())
+      {
+        Instruction *I = workList.pop_back_val();
+        for (Value::use_iterator U = I->use_begin(), E = I->use_end(); U != E; ++U)
+        {
+          Instruction *User = dyn_cast<Instruction>(*U);
+          if (User == NULL)
+            return false;
+          if (Web.count(User))
+            continue;
+          if (User->isTerminator() || User->mayHaveSideEffects() || isa<LandingPadInst>(User))
+            return false;
+          if (Web.size() >= MaxPHIWebSize)
+            return false;
+          Web.insert(User);
+          workList.push_back(User);
+        }
+      }
+      return true;
+    }
+
+    // Remove phi webs whose only uses are inside the web itself. Such a
+    // web is dead as a whole even though every member has a use.
+    bool removeDeadPHICycles(Function &F)
+    {
+      SmallPtrSet<Instruction*, 32> deadWeb;
+
+      for (Function::iterator b = F.begin(), be = F.end(); b != be; b++)
+      {
+        for (BasicBlock::iterator inst = b->begin(), inste = b->end(); inst != inste; inst++)
+        {
+          PHINode *phi = dyn_cast<PHINode>(&*inst);
+          if (phi == NULL)
+            break;
+          if (deadWeb.count(phi))
+            continue;
+
+          SmallPtrSet<Instruction*, 16> web;
+          if (!collectPHIWeb(phi, web))
+            continue;
+          for (SmallPtrSet<Instruction*, 16>::iterator w = web.begin(), we = web.end(); w != we; ++w)
+            deadWeb.insert(*w);
+        }
+      }
+
+      if (deadWeb.empty())
+        return false;
+
+      for (SmallPtrSet<Instruction*, 32>::iterator w = deadWeb.begin(), we = deadWeb.end(); w != we; ++w)
+        Remarks.remark(RemarkEmitter::Passed, "Deleted", *w, LI->getLoopFor((*w)->getParent()),
+                       "dead phi cycle removed");
+      //Break the cycles first so that every member is use free when erased
+      for (SmallPtrSet<Instruction*, 32>::iterator w = deadWeb.begin(), we = deadWeb.end(); w != we; ++w)
+        (*w)->dropAllReferences();
+      for (SmallPtrSet<Instruction*, 32>::iterator w = deadWeb.begin(), we = deadWeb.end(); w != we; ++w)
+        (*w)->eraseFromParent();
+
+      return true;
     }
 
     virtual void getAnalysisUsage(AnalysisUsage &AU) const {
-       AU.setPreservesAll();
+       if (!CleanupCFG)
+         AU.setPreservesCFG();
        AU.addRequired<LoopInfo>();
        AU.addRequired<DominatorTree>();
      }
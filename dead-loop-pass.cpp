@@ -0,0 +1,179 @@
+#include "llvm/Pass.h"
+#include "llvm/Support/CFG.h"
+#include "llvm/Support/InstIterator.h"
+#include "llvm/PassManager.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Analysis/Dominators.h"
+#include "llvm/Analysis/LoopPass.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/ValueMap.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/Support/raw_ostream.h"
+#include "LiveAnalysis.cpp"
+#include <map>
+#include <set>
+#include <vector>
+
+using namespace llvm;
+using namespace std;
+
+STATISTIC(NumDeletedLoops, "Number of dead loops deleted");
+
+namespace
+{
+  // Deletes loops that have no side effects, no live out values
+  // and are known to terminate. The preheader is wired directly
+  // to the exit block.
+  struct DeadLoop : public LoopPass {
+    static char ID;
+    DeadLoop() : LoopPass(ID) {}
+
+    private:
+    LoopInfo* LI;
+    DominatorTree* DT;
+    ScalarEvolution* SE;
+    LiveAnalysis Live;
+
+    virtual bool runOnLoop(Loop *L, LPPassManager &LPM)
+    {
+      LI = &getAnalysis<LoopInfo>();
+      DT = &getAnalysis<DominatorTree>();
+      SE = &getAnalysis<ScalarEvolution>();
+
+      //Inner loops are visited first, so an outer loop becomes a
+      //candidate once all of its dead sub loops have been removed
+      if (!L->empty())
+        return false;
+
+      BasicBlock *Preheader = L->getLoopPreheader();
+      if (!Preheader)
+        return false;
+
+      SmallVector<BasicBlock*, 4> ExitBlocks;
+      L->getUniqueExitBlocks(ExitBlocks);
+      if (ExitBlocks.size() != 1)
+        return false;
+      BasicBlock *ExitBlock = ExitBlocks[0];
+
+      SmallVector<BasicBlock*, 4> ExitingBlocks;
+      L->getExitingBlocks(ExitingBlocks);
+
+      if (hasSideEffects(L))
+        return false;
+
+      if (!hasUniformExitValues(L, ExitBlock, ExitingBlocks))
+        return false;
+
+      //Anything defined in the loop that is live on entry to the
+      //exit block is still needed after the loop
+      Live.runAnalysis(*L->getHeader()->getParent());
+      if (hasLiveOutValues(L, ExitBlock))
+        return false;
+
+      //A loop we cannot bound might be infinite, removing it would
+      //change the behaviour of the program
+      if (isa<SCEVCouldNotCompute>(SE->getMaxBackedgeTakenCount(L)))
+        return false;
+
+      deleteLoop(L, Preheader, ExitBlock, ExitingBlocks, LPM);
+      ++NumDeletedLoops;
+      return true;
+    }
+
+    virtual void getAnalysisUsage(AnalysisUsage &AU) const {
+      AU.addRequired<LoopInfo>();
+      AU.addRequired<DominatorTree>();
+      AU.addRequired<ScalarEvolution>();
+      AU.addPreserved<LoopInfo>();
+      AU.addPreserved<DominatorTree>();
+      AU.addPreserved<ScalarEvolution>();
+    }
+
+    bool hasSideEffects(Loop *L)
+    {
+      for (Loop::block_iterator b = L->block_begin(), be = L->block_end(); b != be; ++b)
+        for (BasicBlock::iterator i = (*b)->begin(), ie = (*b)->end(); i != ie; ++i)
+          if (i->mayHaveSideEffects())
+            return true;
+      return false;
+    }
+
+    // Phis in the exit block must see the same loop invariant value
+    // from every exiting block, it then flows in from the preheader
+    bool hasUniformExitValues(Loop *L, BasicBlock *ExitBlock, SmallVectorImpl<BasicBlock*> &ExitingBlocks)
+    {
+      for (BasicBlock::iterator BI = ExitBlock->begin(); PHINode *PN = dyn_cast<PHINode>(BI); ++BI)
+      {
+        Value *V = PN->getIncomingValueForBlock(ExitingBlocks[0]);
+        for (unsigned i = 1, e = ExitingBlocks.size(); i != e; ++i)
+          if (PN->getIncomingValueForBlock(ExitingBlocks[i]) != V)
+            return false;
+        if (Instruction *I = dyn_cast<Instruction>(V))
+          if (L->contains(I))
+            return false;
+      }
+      return true;
+    }
+
+    bool hasLiveOutValues(Loop *L, BasicBlock *ExitBlock)
+    {
+      for (Loop::block_iterator b = L->block_begin(), be = L->block_end(); b != be; ++b)
+        for (BasicBlock::iterator i = (*b)->begin(), ie = (*b)->end(); i != ie; ++i)
+          if (Live.isLiveIn(i, ExitBlock))
+            return true;
+      return false;
+    }
+
+    void deleteLoop(Loop *L, BasicBlock *Preheader, BasicBlock *ExitBlock, SmallVectorImpl<BasicBlock*> &ExitingBlocks, LPPassManager &LPM)
+    {
+      SE->forgetLoop(L);
+
+      //Send the preheader straight to the exit block
+      Preheader->getTerminator()->replaceUsesOfWith(L->getHeader(), ExitBlock);
+
+      //Exit phis now receive their value from the preheader
+      BasicBlock *ExitingBlock = ExitingBlocks[0];
+      for (BasicBlock::iterator BI = ExitBlock->begin(); PHINode *PN = dyn_cast<PHINode>(BI); ++BI)
+      {
+        PN->setIncomingBlock(PN->getBasicBlockIndex(ExitingBlock), Preheader);
+        for (unsigned i = 1, e = ExitingBlocks.size(); i != e; ++i)
+          PN->removeIncomingValue(ExitingBlocks[i]);
+      }
+
+      //Hand the dominator tree children of the loop over to the
+      //preheader before dropping the loop blocks from the tree
+      SmallVector<DomTreeNode*, 8> ChildNodes;
+      for (Loop::block_iterator b = L->block_begin(), be = L->block_end(); b != be; ++b)
+      {
+        ChildNodes.insert(ChildNodes.begin(), DT->getNode(*b)->begin(), DT->getNode(*b)->end());
+        for (SmallVectorImpl<DomTreeNode*>::iterator c = ChildNodes.begin(), ce = ChildNodes.end(); c != ce; ++c)
+          DT->changeImmediateDominator(*c, DT->getNode(Preheader));
+        ChildNodes.clear();
+        DT->eraseNode(*b);
+        (*b)->dropAllReferences();
+      }
+
+      for (Loop::block_iterator b = L->block_begin(), be = L->block_end(); b != be; ++b)
+        (*b)->eraseFromParent();
+
+      //LoopInfo goes last, the loop block list was needed above
+      SmallPtrSet<BasicBlock*, 8> blocks;
+      blocks.insert(L->block_begin(), L->block_end());
+      for (SmallPtrSet<BasicBlock*, 8>::iterator b = blocks.begin(), be = blocks.end(); b != be; ++b)
+        LI->removeBlock(*b);
+
+      LPM.deleteLoopFromQueue(L);
+    }
+
+  };
+
+char DeadLoop::ID = 0;
+RegisterPass<DeadLoop> X("dead-loop-pass", "Dead Loop Deletion Pass");
+
+}
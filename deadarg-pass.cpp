@@ -0,0 +1,234 @@
+#include "llvm/Pass.h"
+#include "llvm/Support/CFG.h"
+#include "llvm/Support/CallSite.h"
+#include "llvm/Support/InstIterator.h"
+#include "llvm/PassManager.h"
+#include "llvm/IR/Attributes.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Transforms/Utils/Local.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/Support/raw_ostream.h"
+#include "LiveAnalysis.cpp"
+#include <map>
+#include <vector>
+
+using namespace llvm;
+using namespace std;
+
+STATISTIC(NumArgumentsEliminated, "Number of dead arguments removed");
+STATISTIC(NumRetValsEliminated, "Number of unused return values removed");
+
+namespace {
+
+  // Removes arguments that are never live on entry to their function
+  // and return values that are not live after any call. Only functions
+  // with local linkage whose every use is a direct call are rewritten,
+  // all of their call sites are known. Callers stop passing the dead
+  // values, which in turn can make arguments of the callers dead, so
+  // the whole module is redone until nothing changes.
+  class DeadArguments : public ModulePass {
+  public:
+    static char ID;
+    DeadArguments() : ModulePass(ID) {}
+
+    virtual bool runOnModule(Module &M) {
+      bool changed = false;
+      bool iterChanged;
+      do {
+        iterChanged = false;
+        computeLiveness(M);
+        for (Module::iterator f = M.begin(), fe = M.end(); f != fe; ) {
+          Function *F = f++;
+          iterChanged |= removeDeadValues(F);
+        }
+        changed |= iterChanged;
+      } while (iterChanged);
+      return changed;
+    }
+
+  private:
+    LiveAnalysis Live;
+    //Arguments never live on entry, per candidate function
+    map<Function*, SmallVector<bool, 8> > deadArgs;
+    //Calls and invokes whose result is not live after them
+    SmallPtrSet<Instruction*, 32> deadResults;
+
+    static bool isCandidate(Function *F) {
+      return F->hasLocalLinkage() && !F->isDeclaration() && !F->isVarArg() &&
+        !F->hasAddressTaken() && !F->use_empty() &&
+        !F->getAttributes().hasAttribute(AttributeSet::FunctionIndex, Attribute::Naked);
+    }
+
+    void computeLiveness(Module &M) {
+      deadArgs.clear();
+      deadResults.clear();
+      for (Module::iterator f = M.begin(), fe = M.end(); f != fe; f++) {
+        if (f->isDeclaration())
+          continue;
+        Live.runAnalysis(*f);
+
+        for (inst_iterator i = inst_begin(*f), e = inst_end(*f); i != e; i++) {
+          Instruction *I = &*i;
+          if ((isa<CallInst>(I) || isa<InvokeInst>(I)) && !I->getType()->isVoidTy() && !Live.isLiveAfter(I, I))
+            deadResults.insert(I);
+        }
+
+        if (!isCandidate(f))
+          continue;
+        //Arguments are not defined by any instruction, so one live before
+        //the first instruction is used on some path through the function
+        Instruction *First = f->getEntryBlock().begin();
+        SmallVector<bool, 8> &dead = deadArgs[f];
+        for (Function::arg_iterator arg = f->arg_begin(), arge = f->arg_end(); arg != arge; arg++)
+          dead.push_back(!Live.isLiveBefore(&*arg, First));
+      }
+    }
+
+    bool isReturnDead(Function *F) {
+      if (F->getReturnType()->isVoidTy())
+        return false;
+      for (Value::use_iterator UI = F->use_begin(), UE = F->use_end(); UI != UE; ++UI)
+        if (!deadResults.count(cast<Instruction>(*UI)))
+          return false;
+      return true;
+    }
+
+    bool removeDeadValues(Function *F) {
+      map<Function*, SmallVector<bool, 8> >::iterator it = deadArgs.find(F);
+      if (it == deadArgs.end())
+        return false;
+      SmallVector<bool, 8> &dead = it->second;
+      bool retDead = isReturnDead(F);
+      unsigned numDead = 0;
+      for (unsigned i = 0, e = dead.size(); i != e; ++i)
+        numDead += dead[i];
+      if (numDead == 0 && !retDead)
+        return false;
+
+      LLVMContext &Ctx = F->getContext();
+      FunctionType *FTy = F->getFunctionType();
+      const AttributeSet &PAL = F->getAttributes();
+
+      //Return attributes do not fit a void return
+      vector<Type*> Params;
+      SmallVector<AttributeSet, 8> AttributesVec;
+      if (!retDead && PAL.hasAttributes(AttributeSet::ReturnIndex))
+        AttributesVec.push_back(AttributeSet::get(Ctx, PAL.getRetAttributes()));
+      for (unsigned i = 0, e = dead.size(); i != e; ++i) {
+        if (dead[i])
+          continue;
+        Params.push_back(FTy->getParamType(i));
+        if (PAL.hasAttributes(i + 1)) {
+          AttrBuilder B(PAL, i + 1);
+          AttributesVec.push_back(AttributeSet::get(Ctx, Params.size(), B));
+        }
+      }
+      if (PAL.hasAttributes(AttributeSet::FunctionIndex))
+        AttributesVec.push_back(AttributeSet::get(Ctx, PAL.getFnAttributes()));
+
+      Type *RetTy = retDead ? Type::getVoidTy(Ctx) : FTy->getReturnType();
+      FunctionType *NFTy = FunctionType::get(RetTy, Params, false);
+      Function *NF = Function::Create(NFTy, F->getLinkage());
+      NF->copyAttributesFrom(F);
+      NF->setAttributes(AttributeSet::get(Ctx, AttributesVec));
+      F->getParent()->getFunctionList().insert(F, NF);
+      NF->takeName(F);
+
+      while (!F->use_empty())
+        rewriteCallSite(CallSite(F->use_back()), NF, dead, retDead);
+
+      //The body moves over, live arguments map onto the new ones
+      NF->getBasicBlockList().splice(NF->begin(), F->getBasicBlockList());
+      Function::arg_iterator NewArg = NF->arg_begin();
+      unsigned i = 0;
+      for (Function::arg_iterator arg = F->arg_begin(), arge = F->arg_end(); arg != arge; ++arg, ++i) {
+        if (dead[i]) {
+          //Only uses on no path to a return or in unreachable code are left
+          arg->replaceAllUsesWith(UndefValue::get(arg->getType()));
+          continue;
+        }
+        arg->replaceAllUsesWith(NewArg);
+        NewArg->takeName(arg);
+        ++NewArg;
+      }
+
+      if (retDead) {
+        for (Function::iterator b = NF->begin(), be = NF->end(); b != be; b++)
+          if (ReturnInst *RI = dyn_cast<ReturnInst>(b->getTerminator())) {
+            Value *RetVal = RI->getReturnValue();
+            ReturnInst::Create(Ctx, 0, RI);
+            RI->eraseFromParent();
+            RecursivelyDeleteTriviallyDeadInstructions(RetVal);
+          }
+        ++NumRetValsEliminated;
+      }
+      NumArgumentsEliminated += numDead;
+
+      F->eraseFromParent();
+      return true;
+    }
+
+    // Calls NF with the live arguments only, the dead ones are no
+    // longer computed unless something else needs them
+    void rewriteCallSite(CallSite CS, Function *NF, SmallVectorImpl<bool> &dead, bool retDead) {
+      Instruction *Call = CS.getInstruction();
+      LLVMContext &Ctx = Call->getContext();
+      const AttributeSet &CallPAL = CS.getAttributes();
+
+      vector<Value*> Args;
+      SmallVector<Value*, 8> DeadOperands;
+      SmallVector<AttributeSet, 8> AttributesVec;
+      if (!retDead && CallPAL.hasAttributes(AttributeSet::ReturnIndex))
+        AttributesVec.push_back(AttributeSet::get(Ctx, CallPAL.getRetAttributes()));
+      for (unsigned i = 0, e = dead.size(); i != e; ++i) {
+        if (dead[i]) {
+          DeadOperands.push_back(CS.getArgument(i));
+          continue;
+        }
+        Args.push_back(CS.getArgument(i));
+        if (CallPAL.hasAttributes(i + 1)) {
+          AttrBuilder B(CallPAL, i + 1);
+          AttributesVec.push_back(AttributeSet::get(Ctx, Args.size(), B));
+        }
+      }
+      if (CallPAL.hasAttributes(AttributeSet::FunctionIndex))
+        AttributesVec.push_back(AttributeSet::get(Ctx, CallPAL.getFnAttributes()));
+
+      Instruction *New;
+      if (InvokeInst *II = dyn_cast<InvokeInst>(Call)) {
+        New = InvokeInst::Create(NF, II->getNormalDest(), II->getUnwindDest(), Args, "", Call);
+        cast<InvokeInst>(New)->setCallingConv(CS.getCallingConv());
+        cast<InvokeInst>(New)->setAttributes(AttributeSet::get(Ctx, AttributesVec));
+      } else {
+        New = CallInst::Create(NF, Args, "", Call);
+        cast<CallInst>(New)->setCallingConv(CS.getCallingConv());
+        cast<CallInst>(New)->setAttributes(AttributeSet::get(Ctx, AttributesVec));
+        if (cast<CallInst>(Call)->isTailCall())
+          cast<CallInst>(New)->setTailCall();
+      }
+      New->setDebugLoc(Call->getDebugLoc());
+
+      if (retDead) {
+        //A result that is not live can only be used in unreachable code
+        if (!Call->use_empty())
+          Call->replaceAllUsesWith(UndefValue::get(Call->getType()));
+      } else {
+        Call->replaceAllUsesWith(New);
+        New->takeName(Call);
+      }
+      Call->eraseFromParent();
+
+      for (unsigned i = 0, e = DeadOperands.size(); i != e; ++i)
+        RecursivelyDeleteTriviallyDeadInstructions(DeadOperands[i]);
+    }
+  };
+
+char DeadArguments::ID = 0;
+RegisterPass<DeadArguments> X("deadarg-pass", "Dead Argument Elimination Pass");
+}
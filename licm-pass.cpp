@@ -5,6 +5,7 @@
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/Metadata.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/Analysis/Dominators.h"
@@ -21,33 +22,156 @@
 #include "llvm/Analysis/LoopIterator.h"
 #include "llvm/Analysis/ConstantFolding.h"
 #include "llvm/Analysis/ValueTracking.h"
+#include "llvm/Analysis/Loads.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Support/BranchProbability.h"
+#include "llvm/IR/DataLayout.h"
 #include "llvm/ADT/Statistic.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/Support/Debug.h"
-#include "DFATemplate.cpp"
+#include "llvm/Support/CommandLine.h"
+#include "RegPressure.cpp"
+#include "Remarks.cpp"
 #include "llvm/Transforms/Scalar.h"
+#include "llvm/Transforms/Utils/SSAUpdater.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/AliasSetTracker.h"
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/Statistic.h"
 #include <map>
 #include <set>
 #include <vector>
+#include <algorithm>
 #include <ostream>
 #include <fstream>
 #include <iostream>
 
  using namespace llvm;
  using namespace std;
+ STATISTIC(NumSunk, "Number of instructions sunk out of loops");
+ STATISTIC(NumPromoted, "Number of memory locations promoted to registers");
+ STATISTIC(NumPreheaders, "Number of loop preheaders inserted");
+ STATISTIC(NumExitsSplit, "Number of loop exits made dedicated");
+ STATISTIC(NumHoistSuppressed, "Number of cheap hoists suppressed by register pressure");
+ STATISTIC(NumColdSkipped, "Number of hoists skipped from blocks colder than the preheader");
+ STATISTIC(NumReassociated, "Number of expression trees reassociated for hoisting");
+ STATISTIC(NumUnswitched, "Number of loops unswitched");
+ STATISTIC(NumStrengthReduced, "Number of induction variable multiplies strength reduced");
+
+ static cl::opt<bool> HoistNest("licm-nest", cl::init(false),
+   cl::desc("Hoist to the outermost invariant loop in one walk per loop nest"));
+
+ static cl::opt<bool> Reassociate("licm-reassociate", cl::init(true),
+   cl::desc("Group loop invariant operands of associative integer expressions before hoisting"));
+
+ static cl::opt<std::string> LICMRemarksFile("licm-remarks-file", cl::init(""),
+   cl::desc("Write the optimization remarks of licm-pass to this file as YAML"));
+
+ static cl::opt<unsigned> HotBlockPercent("licm-hot-percent", cl::init(80),
+   cl::desc("With profile data, loop blocks run at least this percentage of the header count are hot enough to speculate loads from"));
+
+ static cl::opt<unsigned> UnswitchThreshold("unswitch-threshold", cl::init(100),
+   cl::desc("Largest loop, in instructions, that unswitch-pass will clone"));
+
+ static cl::opt<unsigned> PressureLimit("licm-max-pressure", cl::init(32),
+   cl::desc("Stop hoisting cheap instructions out of a loop once this many values of its register class would be live in it (0 disables)"));
 
  namespace 
  {
+   // Check if V is defined outside of L
+   static bool isInvariantInLoop(Loop *L, Value *V)
+   {
+     if (Instruction *I = dyn_cast<Instruction>(V))
+       return !L->contains(I);
+     return true;
+   }
+
+   // Rewrites the loads and stores of a promoted location with SSA
+   // values and stores the final value back in every exit block.
+   class LoopPromoter : public LoadAndStorePromoter {
+     Value *SomePtr;
+     SmallPtrSet<Value*, 4> &PointerMustAliases;
+     SmallVectorImpl<BasicBlock*> &LoopExitBlocks;
+     AliasSetTracker &AST;
+     unsigned Alignment;
+
+   public:
+     LoopPromoter(Value *SP, const SmallVectorImpl<Instruction*> &Insts, SSAUpdater &S,
+                  SmallPtrSet<Value*, 4> &PMA, SmallVectorImpl<BasicBlock*> &LEB,
+                  AliasSetTracker &ast, unsigned align)
+       : LoadAndStorePromoter(Insts, S), SomePtr(SP), PointerMustAliases(PMA),
+         LoopExitBlocks(LEB), AST(ast), Alignment(align) {}
+
+     virtual bool isInstInList(Instruction *I, const SmallVectorImpl<Instruction*> &) const {
+       Value *Ptr;
+       if (LoadInst *LI = dyn_cast<LoadInst>(I))
+         Ptr = LI->getPointerOperand();
+       else
+         Ptr = cast<StoreInst>(I)->getPointerOperand();
+       return PointerMustAliases.count(Ptr);
+     }
+
+     virtual void doExtraRewritesBeforeFinalDeletion() const {
+       for (unsigned i = 0, e = LoopExitBlocks.size(); i != e; ++i) {
+         BasicBlock *ExitBlock = LoopExitBlocks[i];
+         Value *LiveInValue = SSA.GetValueInMiddleOfBlock(ExitBlock);
+         StoreInst *NewSI = new StoreInst(LiveInValue, SomePtr, ExitBlock->getFirstInsertionPt());
+         NewSI->setAlignment(Alignment);
+       }
+     }
+
+     virtual void replaceLoadWithValue(LoadInst *LI, Value *V) const {
+       AST.copyValue(LI, V);
+     }
+
+     virtual void instructionDeleted(Instruction *I) const {
+       AST.deleteValue(I);
+     }
+   };
+
    struct LICM : public LoopPass {
      static char ID; // Pass identification, replacement for typeid
-     LICM() : LoopPass(ID) {}
+     LICM() : LoopPass(ID), ProfiledFunction(NULL), HasProfile(false),
+              Remarks("licm-pass", LICMRemarksFile) {}
 
      private:
-     bool mayThrow;
+     // Throw and side effect summary of a block, computed once per
+     // function and refreshed only when a throwing instruction moves
+     struct BlockSummary {
+       Instruction *FirstThrow;
+       bool MayWrite;
+     };
+     // Blocks of a loop and its sub loops that may throw, combined
+     // bottom up across the loop tree
+     struct LoopSummary {
+       SmallVector<BasicBlock*, 4> ThrowBlocks;
+       bool MayWrite;
+     };
+     map<BasicBlock*, BlockSummary> BlockSummaries;
+     map<Loop*, LoopSummary> LoopSummaries;
+     //Estimated maximum number of live values per loop, only
+     //computed once hoisting needs them
+     RegPressure PressureInfo;
+     //Frequencies are only trusted when the function has branch weights
+     BlockFrequencyInfo *BFI;
+     Function *ProfiledFunction;
+     bool HasProfile;
+     DataLayout *TD;
+     RemarkEmitter Remarks;
+     //Upper bound on the operations in one reassociated tree
+     static const unsigned MaxReassociationNodes = 16;
      bool changed;
      LoopInfo* LI;
      DominatorTree* DT; 
+     AliasAnalysis* AA;
+     AliasSetTracker* CurAST;
+     //Alias sets of loops whose parent has not been visited yet
+     map<Loop*, AliasSetTracker*> LoopToAliasSetMap;
      Loop* CurrentLoop;
      BasicBlock *Preheader;
      Instruction *InsertPt;
@@ -56,25 +180,68 @@
      {
           LI = &getAnalysis<LoopInfo>();
           DT = &getAnalysis<DominatorTree>();
+          AA = &getAnalysis<AliasAnalysis>();
+          BFI = &getAnalysis<BlockFrequencyInfo>();
+          TD = getAnalysisIfAvailable<DataLayout>();
           CurrentLoop = L;
+          changed = false;
+          PressureInfo.invalidate();
 
-          Preheader = L->getLoopPreheader();
-          InsertPt = Preheader->getTerminator();
+          Function *F = L->getHeader()->getParent();
+          if (F != ProfiledFunction)
+          {
+            ProfiledFunction = F;
+            HasProfile = hasBranchWeights(*F);
+          }
+
+          //Canonical form first: a dedicated preheader and exit blocks
+          //that are only reached from inside the loop
+          Preheader = insertPreheader(L);
+          formDedicatedExits(L);
+          InsertPt = Preheader ? Preheader->getTerminator() : NULL;
   //        errs()<<"Insert point "<<*InsertPt<<"\n";
   //        BasicBlock* bb = L->getUniqueExitBlock();  
     //      errs()<<bb->getName()<<" Exit block name \n";
       //    errs()<<L->getLoopDepth()<<" sub loops \n";
 
-          mayThrow = false;
-          //Check for instructions which can throw. Need to consider their effects
-          checkforThrowIns(mayThrow);
-          if(!mayThrow)
-        //  errs()<<" May throw "<<mayThrow<<" \n";      
+          //Throwing instructions are handled per instruction in isExecuted
+          getLoopSummary(L);
 
+          //Summary of the memory the loop may touch
+          buildLoopAliasSets(L);
 	  
-          if (Preheader)
+          //Expose invariant subexpressions to HoistRegion
+          if (Reassociate)
+            ReassociateRegion(L);
+
+          //Sink first so that values only needed after the loop are
+          //not hoisted into the preheader
+          SinkRegion(DT->getNode(L->getHeader()));
+
+          if (HoistNest)
+          {
+             //Inner loops are covered by the single walk over the nest
+             if (!L->getParentLoop())
+               HoistNestRegion(L);
+          }
+          else if (Preheader)
              HoistRegion(DT->getNode(L->getHeader()));
 
+          if (Preheader)
+             PromoteAliasSets();
+
+          //The parent loop folds our summary into its own
+          if (L->getParentLoop())
+            LoopToAliasSetMap[L] = CurAST;
+          else
+          {
+            delete CurAST;
+            if (HoistNest)
+              releaseNestAliasSets(L);
+          }
+          CurAST = NULL;
+
+          Remarks.emitLoopSummary(L);
           
 
          for (Loop::block_iterator b = L->block_begin(), be = L->block_end();b !=be; ++b)
@@ -87,14 +254,151 @@
          }
          }
 
-       return false;
+       return changed;
      }
 
-     // We don't modify the program, so we preserve all analyses
+     // Preheaders and exits are split with LoopInfo and the dominator
+     // tree kept up to date, other analyses have to be rebuilt
      virtual void getAnalysisUsage(AnalysisUsage &AU) const {
-       AU.setPreservesAll();
        AU.addRequired<LoopInfo>();
        AU.addRequired<DominatorTree>();
+       AU.addRequired<AliasAnalysis>();
+       AU.addRequired<BlockFrequencyInfo>();
+       AU.addPreserved<LoopInfo>();
+       AU.addPreserved<DominatorTree>();
+     }
+
+     // Split the predecessors of the header that are outside the loop
+     // off into a new preheader. LoopInfo and the dominator tree are
+     // updated by SplitBlockPredecessors.
+     BasicBlock* insertPreheader(Loop *L)
+     {
+       if (BasicBlock *PH = L->getLoopPreheader())
+         return PH;
+
+       BasicBlock *Header = L->getHeader();
+       SmallVector<BasicBlock*, 8> OutsidePreds;
+       for (pred_iterator PI = pred_begin(Header), PE = pred_end(Header); PI != PE; ++PI)
+       {
+         BasicBlock *Pred = *PI;
+         if (L->contains(Pred))
+           continue;
+         //An indirectbr edge can not be redirected
+         if (isa<IndirectBrInst>(Pred->getTerminator()))
+           return NULL;
+         OutsidePreds.push_back(Pred);
+       }
+       if (OutsidePreds.empty())
+         return NULL;
+
+       BasicBlock *NewPreheader = SplitBlockPredecessors(Header, OutsidePreds, ".preheader", this);
+       ++NumPreheaders;
+       changed = true;
+       return NewPreheader;
+     }
+
+     // Give every exit block that is also reached from outside the
+     // loop a new block that only the loop branches to
+     void formDedicatedExits(Loop *L)
+     {
+       SmallVector<BasicBlock*, 8> ExitBlocks;
+       L->getUniqueExitBlocks(ExitBlocks);
+
+       for (unsigned i = 0, e = ExitBlocks.size(); i != e; ++i)
+       {
+         BasicBlock *Exit = ExitBlocks[i];
+         if (Exit->isLandingPad())
+           continue;
+
+         SmallVector<BasicBlock*, 8> InLoopPreds;
+         bool outsidePred = false;
+         bool splittable = true;
+         for (pred_iterator PI = pred_begin(Exit), PE = pred_end(Exit); PI != PE; ++PI)
+         {
+           BasicBlock *Pred = *PI;
+           if (!L->contains(Pred))
+             outsidePred = true;
+           else if (isa<IndirectBrInst>(Pred->getTerminator()))
+             splittable = false;
+           else
+             InLoopPreds.push_back(Pred);
+         }
+         if (!outsidePred || !splittable)
+           continue;
+
+         SplitBlockPredecessors(Exit, InLoopPreds, ".loopexit", this);
+         ++NumExitsSplit;
+         changed = true;
+       }
+     }
+
+     // Summaries are per function, the loop pass manager calls this
+     // once it is done with all loops of a function
+     virtual bool doFinalization() {
+       BlockSummaries.clear();
+       LoopSummaries.clear();
+       if (ProfiledFunction)
+         Remarks.emitFunctionSummary(*ProfiledFunction);
+       ProfiledFunction = NULL;
+       return false;
+     }
+
+     // Sub loops are visited first, so their alias sets are merged
+     // in and only the blocks directly in L are scanned again
+     void buildLoopAliasSets(Loop *L)
+     {
+       CurAST = new AliasSetTracker(*AA);
+
+       for (Loop::iterator SL = L->begin(), SLE = L->end(); SL != SLE; ++SL)
+       {
+         map<Loop*, AliasSetTracker*>::iterator it = LoopToAliasSetMap.find(*SL);
+         if (it == LoopToAliasSetMap.end())
+         {
+           //Sub loop added behind our back, scan it directly
+           for (Loop::block_iterator b = (*SL)->block_begin(), be = (*SL)->block_end(); b != be; ++b)
+             CurAST->add(**b);
+           continue;
+         }
+         CurAST->add(*it->second);
+         //The nest walk still needs the summary of every level
+         if (HoistNest)
+           continue;
+         delete it->second;
+         LoopToAliasSetMap.erase(it);
+       }
+
+       for (Loop::block_iterator b = L->block_begin(), be = L->block_end(); b != be; ++b)
+         if (LI->getLoopFor(*b) == L)
+           CurAST->add(**b);
+     }
+
+     // Drop the summaries kept around for the nest rooted at L
+     void releaseNestAliasSets(Loop *L)
+     {
+       for (map<Loop*, AliasSetTracker*>::iterator it = LoopToAliasSetMap.begin(); it != LoopToAliasSetMap.end(); )
+       {
+         map<Loop*, AliasSetTracker*>::iterator cur = it++;
+         if (L->contains(cur->first))
+         {
+           delete cur->second;
+           LoopToAliasSetMap.erase(cur);
+         }
+       }
+     }
+
+     // Keep the cached summaries in sync with other loop passes
+     virtual void cloneBasicBlockAnalysis(BasicBlock *From, BasicBlock *To, Loop *L)
+     {
+       map<Loop*, AliasSetTracker*>::iterator it = LoopToAliasSetMap.find(L);
+       if (it != LoopToAliasSetMap.end())
+         it->second->copyValue(From, To);
+     }
+
+     virtual void deleteAnalysisValue(Value *V, Loop *L)
+     {
+       map<Loop*, AliasSetTracker*>::iterator it = LoopToAliasSetMap.find(L);
+       if (it != LoopToAliasSetMap.end())
+         it->second->deleteValue(V);
      }
 
      bool inSubLoop(BasicBlock *bb)
@@ -112,16 +416,72 @@
       if (isSafeToSpeculativelyExecute(&Inst))
         return true;
  
-      return isExecuted(Inst);
+      if (isExecuted(Inst))
+        return true;
+
+      //A hot path runs nearly every iteration, so a load there may be
+      //moved up when it can not trap from the preheader
+      return isHotBlock(Inst.getParent()) && isSafeToSpeculateLoad(Inst);
    } 
 
+   bool isSafeToSpeculateLoad(Instruction &I)
+   {
+      LoadInst *Load = dyn_cast<LoadInst>(&I);
+      if (!Load || !Load->isUnordered())
+        return false;
+      return isSafeToLoadUnconditionally(Load->getPointerOperand(), Preheader->getTerminator(),
+                                         Load->getAlignment(), TD);
+   }
+
+   // Profile data is there when any branch carries weights
+   static bool hasBranchWeights(Function &F)
+   {
+      for (Function::iterator BB = F.begin(), E = F.end(); BB != E; ++BB)
+        if (BB->getTerminator()->getMetadata(LLVMContext::MD_prof))
+          return true;
+      return false;
+   }
+
+   // A preheader inserted by this pass is unknown to BlockFrequencyInfo,
+   // it runs at most as often as its predecessors together
+   BlockFrequency getPreheaderFreq()
+   {
+      BlockFrequency Freq = BFI->getBlockFreq(Preheader);
+      if (Freq.getFrequency())
+        return Freq;
+      for (pred_iterator PI = pred_begin(Preheader), PE = pred_end(Preheader); PI != PE; ++PI)
+        Freq += BFI->getBlockFreq(*PI);
+      return Freq;
+   }
+
+   // Moving work out of a block that runs less often than the preheader
+   // makes it run more often. Blocks without a frequency (made after the
+   // analysis ran) are left to the other checks.
+   bool isColdForHoist(Instruction &I)
+   {
+      if (!HasProfile)
+        return false;
+      BlockFrequency Freq = BFI->getBlockFreq(I.getParent());
+      return Freq.getFrequency() && Freq < getPreheaderFreq();
+   }
+
+   bool isHotBlock(BasicBlock *BB)
+   {
+      if (!HasProfile)
+        return false;
+      BlockFrequency Freq = BFI->getBlockFreq(BB);
+      BlockFrequency Threshold = BFI->getBlockFreq(CurrentLoop->getHeader());
+      Threshold *= BranchProbability(std::min<unsigned>(HotBlockPercent, 100), 100);
+      return Freq.getFrequency() && !(Freq < Threshold);
+   }
+
    // Check if ins is executed
    //a> No throwing ins
    //b> Dominates all exit blocks of loop  
    //c> Check if loop is not infinie
    bool isExecuted(Instruction &I){
 
-       if(mayThrow)
+       if (mayThrowBefore(I))
          return false;
 
        if (I.getParent() == CurrentLoop->getHeader())
@@ -144,12 +504,87 @@
    } 
 
 
-   void checkforThrowIns(bool& mayThrow){
-      
-      for (Loop::block_iterator BB = CurrentLoop->block_begin(), BBE = CurrentLoop->block_end();(BB != BBE) && !mayThrow ; ++BB)
-         for (BasicBlock::iterator I = (*BB)->begin(), E = (*BB)->end();(I != E) && !mayThrow; ++I)
-                   mayThrow |= I->mayThrow();        
+   BlockSummary& getBlockSummary(BasicBlock *BB)
+   {
+      map<BasicBlock*, BlockSummary>::iterator it = BlockSummaries.find(BB);
+      if (it != BlockSummaries.end())
+        return it->second;
+
+      BlockSummary &Summary = BlockSummaries[BB];
+      Summary.FirstThrow = NULL;
+      Summary.MayWrite = false;
+      for (BasicBlock::iterator I = BB->begin(), E = BB->end(); I != E; ++I)
+      {
+        if (!Summary.FirstThrow && I->mayThrow())
+          Summary.FirstThrow = I;
+        Summary.MayWrite |= I->mayWriteToMemory();
+      }
+      return Summary;
+   }
+
+   // Inner loops are visited first, so their summaries are already
+   // there and only the blocks directly in L are looked at
+   LoopSummary& getLoopSummary(Loop *L)
+   {
+      map<Loop*, LoopSummary>::iterator it = LoopSummaries.find(L);
+      if (it != LoopSummaries.end())
+        return it->second;
+
+      LoopSummary Summary;
+      Summary.MayWrite = false;
+      for (Loop::iterator SL = L->begin(), SLE = L->end(); SL != SLE; ++SL)
+      {
+        LoopSummary &Inner = getLoopSummary(*SL);
+        Summary.ThrowBlocks.append(Inner.ThrowBlocks.begin(), Inner.ThrowBlocks.end());
+        Summary.MayWrite |= Inner.MayWrite;
+      }
+
+      for (Loop::block_iterator BB = L->block_begin(), BBE = L->block_end(); BB != BBE; ++BB)
+      {
+        if (LI->getLoopFor(*BB) != L)
+          continue;
+        BlockSummary &Block = getBlockSummary(*BB);
+        if (Block.FirstThrow)
+          Summary.ThrowBlocks.push_back(*BB);
+        Summary.MayWrite |= Block.MayWrite;
+      }
+
+      return LoopSummaries[L] = Summary;
+   }
+
+   // Forget the summaries that depend on BB after its contents changed
+   void invalidateSummary(BasicBlock *BB)
+   {
+      BlockSummaries.erase(BB);
+      for (Loop *L = LI->getLoopFor(BB); L; L = L->getParentLoop())
+        LoopSummaries.erase(L);
+   }
+
+   // Check if an instruction that may throw can run before I in the
+   // first iteration. Every throwing instruction in the loop has to
+   // come after I in its block or be dominated by I's block.
+   bool mayThrowBefore(Instruction &I)
+   {
+      LoopSummary &Summary = getLoopSummary(CurrentLoop);
+      BasicBlock *BB = I.getParent();
 
+      for (unsigned i = 0, e = Summary.ThrowBlocks.size(); i != e; ++i)
+      {
+        BasicBlock *ThrowBB = Summary.ThrowBlocks[i];
+        Instruction *Throw = getBlockSummary(ThrowBB).FirstThrow;
+        if (!Throw)
+          continue;
+
+        if (ThrowBB == BB)
+        {
+          for (BasicBlock::iterator II = BB->begin(); &*II != &I; ++II)
+            if (&*II == Throw)
+              return true;
+        }
+        else if (!DT->dominates(BB, ThrowBB))
+          return true;
+      }
+      return false;
    }
 
   
@@ -169,6 +604,9 @@
           if (Constant *C = ConstantFoldInstruction(&I)) 
           {
              I.replaceAllUsesWith(C);
+             CurAST->deleteValue(&I);
+             if (I.mayThrow())
+               invalidateSummary(I.getParent());
              I.eraseFromParent();
              continue;
           }
@@ -181,8 +619,7 @@
             
 
        // Check for Instruction invaraince. If yes hoist to preheader
-          if (checkforInvariance(&I) && validateHoist(I) &&
-             isSafeToHoist(I))
+          if (checkforInvariance(&I) && canHoist(I, true))
           {
             //errs()<<"Hoisting\n";
             hoist(I);
@@ -193,6 +630,293 @@
          HoistRegion(Children[i]);
    }
 
+   // Hoisting for the whole nest rooted at Outer in one walk of the
+   // dominator tree. Each instruction is moved straight to the
+   // preheader of the outermost loop it is invariant in.
+   void HoistNestRegion(Loop *Outer)
+   {
+        //The map only lends OuterAST to the walk, runOnLoop owns it
+        AliasSetTracker *OuterAST = CurAST;
+        LoopToAliasSetMap[Outer] = OuterAST;
+
+        HoistNestRegion(DT->getNode(Outer->getHeader()), Outer);
+
+        LoopToAliasSetMap.erase(Outer);
+        CurrentLoop = Outer;
+        Preheader = Outer->getLoopPreheader();
+        CurAST = OuterAST;
+   }
+
+   void HoistNestRegion(DomTreeNode *N, Loop *Outer) {
+        assert(N != 0 && "Null DT node");
+        BasicBlock *BB = N->getBlock();
+        if (!Outer->contains(BB)) return;
+
+        Loop *InnerMost = LI->getLoopFor(BB);
+        for (BasicBlock::iterator II = BB->begin(), E = BB->end(); II != E; ) {
+          Instruction &I = *II++;
+
+          if (Constant *C = ConstantFoldInstruction(&I))
+          {
+             I.replaceAllUsesWith(C);
+             for (Loop *X = InnerMost; X; X = X->getParentLoop())
+               getNestAliasSets(X)->deleteValue(&I);
+             if (I.mayThrow())
+               invalidateSummary(I.getParent());
+             I.eraseFromParent();
+             continue;
+          }
+
+          hoistToOutermost(I, InnerMost);
+        }
+
+        const std::vector<DomTreeNode*> &Children = N->getChildren();
+        for (unsigned i = 0, e = Children.size(); i != e; ++i)
+          HoistNestRegion(Children[i], Outer);
+   }
+
+   // Summary of X kept for the nest walk, built on the spot for a
+   // loop that was added after its parent was visited
+   AliasSetTracker* getNestAliasSets(Loop *X)
+   {
+        map<Loop*, AliasSetTracker*>::iterator it = LoopToAliasSetMap.find(X);
+        if (it != LoopToAliasSetMap.end())
+          return it->second;
+
+        AliasSetTracker *AST = new AliasSetTracker(*AA);
+        for (Loop::block_iterator b = X->block_begin(), be = X->block_end(); b != be; ++b)
+          AST->add(**b);
+        LoopToAliasSetMap[X] = AST;
+        return AST;
+   }
+
+   // Switch the per loop state used by the hoisting checks to X
+   void setHoistLoop(Loop *X)
+   {
+        CurrentLoop = X;
+        Preheader = X->getLoopPreheader();
+        CurAST = getNestAliasSets(X);
+   }
+
+   // Invariance only grows towards the inner loops, so walk outwards
+   // until an operand is defined inside, then try the outermost
+   // candidate first and fall back inwards if it can not take I
+   bool hoistToOutermost(Instruction &I, Loop *InnerMost)
+   {
+        SmallVector<Loop*, 4> Candidates;
+        for (Loop *X = InnerMost; X; X = X->getParentLoop())
+        {
+          CurrentLoop = X;
+          if (!checkforInvariance(&I))
+            break;
+          Candidates.push_back(X);
+        }
+
+        for (unsigned i = Candidates.size(); i != 0; --i)
+        {
+          setHoistLoop(Candidates[i - 1]);
+          if (!Preheader)
+            continue;
+          //Only the innermost candidate reports why it was missed
+          if (canHoist(I, i == 1))
+          {
+            hoist(I);
+            return true;
+          }
+        }
+        return false;
+   }
+
+   // Commutative and associative integer operations we regroup
+   static bool isReassociable(Instruction *I)
+   {
+      if (!I->getType()->isIntegerTy())
+        return false;
+      switch (I->getOpcode()) {
+        case Instruction::Add:
+        case Instruction::Mul:
+        case Instruction::And:
+        case Instruction::Or:
+        case Instruction::Xor:
+          return true;
+        default:
+          return false;
+      }
+   }
+
+   // Depth of the loop V is defined in, zero for values outside loops
+   unsigned getRank(Value *V)
+   {
+      if (Instruction *I = dyn_cast<Instruction>(V))
+        return LI->getLoopDepth(I->getParent());
+      return 0;
+   }
+
+   // Invariant operands first, outermost ones before inner ones,
+   // operands that vary in the loop keep their order at the end
+   unsigned getReassociationKey(Value *V)
+   {
+      if (isInvariant(V))
+        return getRank(V);
+      return ~0U;
+   }
+
+   // Collect the leaves of the tree of Opcode operations rooted at V.
+   // Inner nodes have to be in the loop with their parent as only user.
+   void linearizeTree(Value *V, unsigned Opcode, bool isRoot, SmallVectorImpl<Value*> &Leaves, SmallVectorImpl<BinaryOperator*> &Nodes)
+   {
+      BinaryOperator *BO = dyn_cast<BinaryOperator>(V);
+      if (BO && BO->getOpcode() == Opcode && Nodes.size() < MaxReassociationNodes &&
+          (isRoot || (BO->hasOneUse() && CurrentLoop->contains(BO))))
+      {
+        Nodes.push_back(BO);
+        linearizeTree(BO->getOperand(0), Opcode, false, Leaves, Nodes);
+        linearizeTree(BO->getOperand(1), Opcode, false, Leaves, Nodes);
+        return;
+      }
+      Leaves.push_back(V);
+   }
+
+   // Rebuild each expression tree in the loop as a left leaning chain
+   // over its leaves ordered by getReassociationKey, so that groups of
+   // invariant operands become separate instructions HoistRegion moves
+   void ReassociateRegion(Loop *L)
+   {
+      for (Loop::block_iterator b = L->block_begin(), be = L->block_end(); b != be; ++b)
+      {
+        if (inSubLoop(*b))
+          continue;
+        for (BasicBlock::iterator II = (*b)->begin(), E = (*b)->end(); II != E; )
+        {
+          Instruction *I = II++;
+          if (!isReassociable(I))
+            continue;
+
+          //Only start at the root of a tree
+          if (I->hasOneUse())
+            if (BinaryOperator *User = dyn_cast<BinaryOperator>(*I->use_begin()))
+              if (User->getOpcode() == I->getOpcode() && CurrentLoop->contains(User))
+                continue;
+
+          reassociateTree(cast<BinaryOperator>(I));
+        }
+      }
+   }
+
+   bool reassociateTree(BinaryOperator *Root)
+   {
+      SmallVector<Value*, 8> Leaves;
+      SmallVector<BinaryOperator*, 8> Nodes;
+      linearizeTree(Root, Root->getOpcode(), true, Leaves, Nodes);
+
+      unsigned invariantLeaves = 0;
+      for (unsigned i = 0, e = Leaves.size(); i != e; ++i)
+        if (isInvariant(Leaves[i]))
+          ++invariantLeaves;
+      //Nothing to group, or the whole tree is invariant anyway
+      if (invariantLeaves < 2 || invariantLeaves == Leaves.size())
+        return false;
+
+      SmallVector<pair<unsigned, unsigned>, 8> Keys;
+      for (unsigned i = 0, e = Leaves.size(); i != e; ++i)
+        Keys.push_back(make_pair(getReassociationKey(Leaves[i]), i));
+      std::stable_sort(Keys.begin(), Keys.end());
+
+      //Skip trees that already are a left chain in the wanted order
+      bool leftChain = true;
+      for (unsigned i = 0, e = Nodes.size(); i + 1 < e; ++i)
+        if (Nodes[i]->getOperand(0) != Nodes[i + 1])
+          leftChain = false;
+      bool ordered = true;
+      for (unsigned i = 0, e = Keys.size(); i != e; ++i)
+        if (Keys[i].second != i)
+          ordered = false;
+      if (leftChain && ordered)
+        return false;
+
+      Value *Acc = Leaves[Keys[0].second];
+      for (unsigned i = 1, e = Keys.size(); i != e; ++i)
+        Acc = BinaryOperator::Create(Root->getOpcode(), Acc, Leaves[Keys[i].second], Root->getName() + ".reass", Root);
+
+      Root->replaceAllUsesWith(Acc);
+      Acc->takeName(Root);
+      for (unsigned i = 0, e = Nodes.size(); i != e; ++i)
+        Nodes[i]->dropAllReferences();
+      for (unsigned i = 0, e = Nodes.size(); i != e; ++i)
+        Nodes[i]->eraseFromParent();
+
+      ++NumReassociated;
+      changed = true;
+      return true;
+   }
+
+   // Post order walk of the dominator tree, users of an instruction
+   // are sunk before the instruction itself is looked at
+   void SinkRegion(DomTreeNode *N) {
+        assert(N != 0 && "Null DT node");
+        BasicBlock *BB = N->getBlock();
+        if (!CurrentLoop->contains(BB)) return;
+
+        const std::vector<DomTreeNode*> &Children = N->getChildren();
+        for (unsigned i = 0, e = Children.size(); i != e; ++i)
+          SinkRegion(Children[i]);
+
+        if (inSubLoop(BB)) return;
+
+        for (BasicBlock::iterator II = BB->end(); II != BB->begin(); ) {
+          Instruction &I = *--II;
+
+          if (!I.use_empty() && !isUsedinLoop(I) && validateSink(I))
+          {
+            //If I leaves the block, go on from the one before it. If it
+            //stays, II is still on I and the next step moves past it.
+            bool atBegin = II == BB->begin();
+            BasicBlock::iterator Prev = II;
+            if (!atBegin)
+              --Prev;
+            if (sink(I))
+              II = atBegin ? BB->begin() : ++Prev;
+          }
+        }
+   }
+
+   // All checks for hoisting an invariant I. With Report set a missed
+   // remark names the first check that failed.
+   bool canHoist(Instruction &I, bool Report)
+   {
+      if (!isMovable(I) && !isa<LoadInst>(I) && !isa<CallInst>(I))
+        return false;
+      if (isa<DbgInfoIntrinsic>(I))
+        return false;
+
+      const char *Reason;
+      if (!validateHoist(I))
+        Reason = isSafeToHoist(I) ? "reads memory that may change in the loop"
+                                  : "may trap and does not run on every iteration";
+      else if (!isSafeToHoist(I))
+        Reason = "may trap and does not run on every iteration";
+      else if (isColdForHoist(I))
+      {
+        Reason = "its block runs less often than the preheader";
+        if (Report)
+          ++NumColdSkipped;
+      }
+      else if (suppressForPressure(I))
+      {
+        Reason = "register pressure in the loop is too high";
+        //Only the last loop tried for I reports, so I stays
+        if (Report)
+          ++NumHoistSuppressed;
+      }
+      else
+        return true;
+
+      if (Report)
+        Remarks.remark(RemarkEmitter::Missed, "NotHoisted", &I, CurrentLoop,
+                       Twine("loop invariant not hoisted: ") + Reason);
+      return false;
+   }
+
    //Certain load and call instructions are not to be hoisted
    bool validateHoist(Instruction &I){
 
@@ -201,21 +925,362 @@
        return false;
      if (LI->getMetadata("invariant.load"))
        return true;
+     if (AA->pointsToConstantMemory(LI->getOperand(0)))
+       return isSafeToHoist(I);
+
+     //Invariant if nothing in the loop may write the loaded memory
+     if (!getLoopSummary(CurrentLoop).MayWrite)
+       return isSafeToHoist(I);
+     uint64_t Size = 0;
+     if (LI->getType()->isSized())
+       Size = AA->getTypeStoreSize(LI->getType());
+     if (pointerInvalidatedByLoop(LI->getOperand(0), Size, LI->getMetadata(LLVMContext::MD_tbaa)))
+       return false;
+     return isSafeToHoist(I);
      }
-     //From LLVM API only these instructions to be hoisted
-     if (!isa<BinaryOperator>(I) && !isa<CastInst>(I) && !isa<SelectInst>(I) && !isa<GetElementPtrInst>(I) && !isa<CmpInst>(I)                    &&!isa<InsertElementInst>(I) && !isa<ExtractElementInst>(I) && !isa<ShuffleVectorInst>(I) && !isa<ExtractValueInst>(I) && !isa<InsertValueInst>(I))
+
+   if (CallInst *CI = dyn_cast<CallInst>(&I)) {
+     if (isa<DbgInfoIntrinsic>(I))
+       return false;
+
+     AliasAnalysis::ModRefBehavior Behavior = AA->getModRefBehavior(CI);
+     if (Behavior == AliasAnalysis::DoesNotAccessMemory)
+       return isSafeToHoist(I);
+     if (!AliasAnalysis::onlyReadsMemory(Behavior))
+       return false;
+     if (!getLoopSummary(CurrentLoop).MayWrite)
+       return isSafeToHoist(I);
+
+     //Only the pointer arguments are read, check just those
+     if (Behavior == AliasAnalysis::OnlyReadsArgumentPointees) {
+       for (unsigned i = 0, e = CI->getNumArgOperands(); i != e; ++i) {
+         Value *Op = CI->getArgOperand(i);
+         if (Op->getType()->isPointerTy() && pointerInvalidatedByLoop(Op, AliasAnalysis::UnknownSize, 0))
+           return false;
+       }
+       return isSafeToHoist(I);
+     }
+
+     //Any memory may be read, so nothing may be written in the loop
+     for (AliasSetTracker::iterator AS = CurAST->begin(), E = CurAST->end(); AS != E; ++AS)
+       if (!AS->isForwardingAliasSet() && AS->isMod())
+         return false;
+     return isSafeToHoist(I);
+     }
+
+     if (!isMovable(I))
      return false;
 
      return isSafeToHoist(I);
  
    }
 
+   // Check the loop summary for a write that may alias V
+   bool pointerInvalidatedByLoop(Value *V, uint64_t Size, const MDNode *TBAAInfo)
+   {
+      return CurAST->getAliasSetForPointer(V, Size, TBAAInfo).isMod();
+   }
+
+   //Sinking never executes I more often than before, so trapping
+   //instructions are fine as long as they have no side effects
+   bool validateSink(Instruction &I){
+
+   if (LoadInst *LI = dyn_cast<LoadInst>(&I))
+     return LI->isUnordered() && LI->getMetadata("invariant.load");
+
+     return isMovable(I);
+   }
+
+   //From LLVM API only these instructions to be moved
+   static bool isMovable(Instruction &I){
+     return isa<BinaryOperator>(I) || isa<CastInst>(I) || isa<SelectInst>(I) || isa<GetElementPtrInst>(I) || isa<CmpInst>(I) || isa<InsertElementInst>(I) || isa<ExtractElementInst>(I) || isa<ShuffleVectorInst>(I) || isa<ExtractValueInst>(I) || isa<InsertValueInst>(I);
+   }
+
+   // Instructions that are cheaper to recompute in the loop than to
+   // keep live in a register across it
+   static bool isCheapToRecompute(Instruction &I)
+   {
+      if (isa<CastInst>(I) || isa<GetElementPtrInst>(I) || isa<CmpInst>(I))
+        return true;
+      switch (I.getOpcode()) {
+        case Instruction::Add:
+        case Instruction::Sub:
+        case Instruction::And:
+        case Instruction::Or:
+        case Instruction::Xor:
+        case Instruction::Shl:
+        case Instruction::LShr:
+        case Instruction::AShr:
+          return true;
+        default:
+          return false;
+      }
+   }
+
+   // Maximum number of values of the register class of Ty live at
+   // any instruction of L
+   unsigned getLoopPressure(Loop *L, Type *Ty)
+   {
+      PressureInfo.compute(*L->getHeader()->getParent());
+      return PressureInfo.getLoopPressure(L)[RegPressure::getRegClass(Ty)];
+   }
+
+   // Leave a cheap instruction in the loop when one more hoisted value
+   // would exceed the pressure limit of its register class
+   bool suppressForPressure(Instruction &I)
+   {
+      if (PressureLimit == 0 || !isCheapToRecompute(I))
+        return false;
+      return getLoopPressure(CurrentLoop, I.getType()) + 1 > PressureLimit;
+   }
+
+   // A hoisted value stays live across the whole loop it left
+   void notePressure(Loop *L, Instruction &I)
+   {
+      PressureInfo.noteLiveAcross(L, I.getType());
+   }
+
    void hoist(Instruction &I) {
+      Remarks.remark(RemarkEmitter::Passed, "Hoisted", &I, CurrentLoop,
+                     "hoisted to " + Preheader->getName());
+      notePressure(CurrentLoop, I);
+      if (I.mayThrow())
+      {
+        invalidateSummary(I.getParent());
+        invalidateSummary(Preheader);
+      }
       I.moveBefore(Preheader->getTerminator());
       changed = true;
 
    }
 
+   // Promote every must alias set that is modified in the loop and
+   // has a loop invariant address to a register
+   void PromoteAliasSets()
+   {
+      SmallVector<AliasSet*, 8> Candidates;
+      for (AliasSetTracker::iterator AS = CurAST->begin(), E = CurAST->end(); AS != E; ++AS)
+      {
+        if (AS->isForwardingAliasSet() || !AS->isMod() || !AS->isMustAlias() || AS->isVolatile())
+          continue;
+        if (!CurrentLoop->isLoopInvariant(AS->begin()->getValue()))
+          continue;
+        Candidates.push_back(&*AS);
+      }
+
+      //Promotion updates the tracker, so the sets are collected first
+      for (unsigned i = 0, e = Candidates.size(); i != e; ++i)
+        promoteAliasSet(*Candidates[i]);
+   }
+
+   // Load the location once in the preheader, carry it through phis in
+   // the loop and store it once in every exit block
+   bool promoteAliasSet(AliasSet &AS)
+   {
+      //An earlier promotion may have emptied this set
+      if (AS.isForwardingAliasSet() || AS.empty())
+        return false;
+      Value *SomePtr = AS.begin()->getValue();
+
+      //Only locals and globals, anything else might be visible elsewhere
+      Value *Object = GetUnderlyingObject(SomePtr);
+      if (!isa<AllocaInst>(Object) && !isa<GlobalVariable>(Object))
+        return false;
+
+      //A throw would leave the loop without reaching the exit stores,
+      //so unlike hoisting this needs a loop that can not throw at all
+      if (!getLoopSummary(CurrentLoop).ThrowBlocks.empty())
+        return false;
+
+      //The stores placed in the exits must only be seen from the loop
+      SmallVector<BasicBlock*, 8> ExitBlocks;
+      CurrentLoop->getUniqueExitBlocks(ExitBlocks);
+      if (ExitBlocks.empty())
+        return false;
+      for (unsigned i = 0, e = ExitBlocks.size(); i != e; ++i)
+        for (pred_iterator PI = pred_begin(ExitBlocks[i]), PE = pred_end(ExitBlocks[i]); PI != PE; ++PI)
+          if (!CurrentLoop->contains(*PI))
+            return false;
+
+      SmallPtrSet<Value*, 4> PointerMustAliases;
+      SmallVector<Instruction*, 64> LoopUses;
+      unsigned Alignment = 0;
+      bool GuaranteedStore = false;
+
+      for (AliasSet::iterator ASI = AS.begin(), ASE = AS.end(); ASI != ASE; ++ASI)
+      {
+        Value *Ptr = ASI->getValue();
+        //Loads and stores of different widths are not promoted
+        if (Ptr->getType() != SomePtr->getType())
+          return false;
+        PointerMustAliases.insert(Ptr);
+
+        for (Value::use_iterator UI = Ptr->use_begin(), UE = Ptr->use_end(); UI != UE; ++UI)
+        {
+          Instruction *Use = dyn_cast<Instruction>(*UI);
+          if (!Use || !CurrentLoop->contains(Use))
+            continue;
+
+          unsigned UseAlignment;
+          if (LoadInst *Load = dyn_cast<LoadInst>(Use))
+          {
+            if (!Load->isSimple())
+              return false;
+            UseAlignment = Load->getAlignment();
+          }
+          else if (StoreInst *Store = dyn_cast<StoreInst>(Use))
+          {
+            //Storing the pointer itself does not touch the location
+            if (Store->getPointerOperand() != Ptr)
+              continue;
+            if (!Store->isSimple())
+              return false;
+            UseAlignment = Store->getAlignment();
+          }
+          else
+            return false;
+
+          if (Alignment == 0 || UseAlignment < Alignment)
+            Alignment = UseAlignment;
+          //The exit stores may only add a store on paths that already
+          //store, and such a store also makes the preheader load safe
+          if (!GuaranteedStore && isa<StoreInst>(Use))
+            GuaranteedStore = isExecuted(*Use);
+          LoopUses.push_back(Use);
+        }
+      }
+
+      if (!GuaranteedStore || LoopUses.empty())
+        return false;
+
+      SmallVector<PHINode*, 16> NewPHIs;
+      SSAUpdater SSA(&NewPHIs);
+      LoopPromoter Promoter(SomePtr, LoopUses, SSA, PointerMustAliases, ExitBlocks, *CurAST, Alignment);
+
+      LoadInst *PreheaderLoad = new LoadInst(SomePtr, SomePtr->getName() + ".promoted", Preheader->getTerminator());
+      PreheaderLoad->setAlignment(Alignment);
+      SSA.AddAvailableValue(Preheader, PreheaderLoad);
+
+      //The loads and stores are gone after the rewrite
+      Remarks.remark(RemarkEmitter::Passed, "Promoted", LoopUses[0], CurrentLoop,
+                     "memory at " + SomePtr->getName() + " promoted to a register");
+      Promoter.run(LoopUses);
+
+      if (PreheaderLoad->use_empty())
+        PreheaderLoad->eraseFromParent();
+
+      for (unsigned i = 0, e = ExitBlocks.size(); i != e; ++i)
+        invalidateSummary(ExitBlocks[i]);
+
+      ++NumPromoted;
+      changed = true;
+      return true;
+   }
+
+   // Find the exit block dominating UseBlock, null if there is none
+   BasicBlock* getDominatingExit(SmallVectorImpl<BasicBlock*> &ExitBlocks, BasicBlock *UseBlock)
+   {
+      for (unsigned i = 0, e = ExitBlocks.size(); i != e; ++i)
+        if (DT->dominates(ExitBlocks[i], UseBlock))
+          return ExitBlocks[i];
+      return NULL;
+   }
+
+   // Move I out of the loop. Every use (all of them are outside the
+   // loop) gets the copy of I placed in the exit block dominating it.
+   // Phis in an exit block that only forward I are replaced by the copy.
+   bool sink(Instruction &I)
+   {
+      SmallVector<BasicBlock*, 8> ExitBlocks;
+      CurrentLoop->getUniqueExitBlocks(ExitBlocks);
+      if (ExitBlocks.empty())
+        return false;
+
+      SmallVector<pair<Use*, BasicBlock*>, 8> SinkUses;
+      SmallVector<pair<PHINode*, BasicBlock*>, 4> ExitPHIs;
+
+      for (Value::use_iterator UI = I.use_begin(), UE = I.use_end(); UI != UE; ++UI)
+      {
+        Instruction *User = cast<Instruction>(*UI);
+        BasicBlock *UseBlock = User->getParent();
+        PHINode *PN = dyn_cast<PHINode>(User);
+
+        if (PN && isRedundantPHI(*PN, I))
+        {
+          //LCSSA phi, the copy takes its place in that very block
+          if (find(ExitBlocks.begin(), ExitBlocks.end(), UseBlock) == ExitBlocks.end())
+            return false;
+          for (Value::use_iterator PI = PN->use_begin(), PE = PN->use_end(); PI != PE; ++PI)
+            if (isa<PHINode>(*PI))
+              return false;
+          ExitPHIs.push_back(make_pair(PN, UseBlock));
+          continue;
+        }
+
+        //A phi uses the value at the end of the incoming block
+        if (PN)
+          UseBlock = PN->getIncomingBlock(UI.getUse());
+
+        BasicBlock *Exit = getDominatingExit(ExitBlocks, UseBlock);
+        if (Exit == NULL)
+          return false;
+        SinkUses.push_back(make_pair(&UI.getUse(), Exit));
+      }
+
+      //The operands of I have to be available in every exit we sink to
+      map<BasicBlock*, Instruction*> Copies;
+      for (unsigned i = 0, e = SinkUses.size(); i != e; ++i)
+        Copies[SinkUses[i].second] = NULL;
+      for (unsigned i = 0, e = ExitPHIs.size(); i != e; ++i)
+        Copies[ExitPHIs[i].second] = NULL;
+      for (map<BasicBlock*, Instruction*>::iterator it = Copies.begin(), ite = Copies.end(); it != ite; ++it)
+        if (!DT->dominates(I.getParent(), it->first))
+          return false;
+
+      //Move I into the first exit and clone it into the others
+      bool moved = false;
+      for (map<BasicBlock*, Instruction*>::iterator it = Copies.begin(), ite = Copies.end(); it != ite; ++it)
+      {
+        Instruction *Copy;
+        if (!moved)
+        {
+          Copy = &I;
+          moved = true;
+        }
+        else
+        {
+          Copy = I.clone();
+          if (I.hasName())
+            Copy->setName(I.getName() + ".sink");
+        }
+        it->second = Copy;
+      }
+
+      for (unsigned i = 0, e = SinkUses.size(); i != e; ++i)
+        SinkUses[i].first->set(Copies[SinkUses[i].second]);
+
+      for (map<BasicBlock*, Instruction*>::iterator it = Copies.begin(), ite = Copies.end(); it != ite; ++it)
+      {
+        if (it->second == &I)
+          I.moveBefore(it->first->getFirstInsertionPt());
+        else
+          it->second->insertBefore(it->first->getFirstInsertionPt());
+      }
+
+      for (unsigned i = 0, e = ExitPHIs.size(); i != e; ++i)
+      {
+        PHINode *PN = ExitPHIs[i].first;
+        PN->replaceAllUsesWith(Copies[ExitPHIs[i].second]);
+        PN->eraseFromParent();
+      }
+
+      Remarks.remark(RemarkEmitter::Passed, "Sunk", &I, CurrentLoop,
+                     "sunk into " + Twine(Copies.size()) + " exit blocks");
+      ++NumSunk;
+      changed = true;
+      return true;
+   }
+
 
 
 //Check if instruction is used in loop handling special case for phi nodes
@@ -275,9 +1340,7 @@
 
   bool isInvariant(Value *V) const 
   {
-   if (Instruction *I = dyn_cast<Instruction>(V))
-     return !CurrentLoop->contains(I);
-   return true;  
+   return isInvariantInLoop(CurrentLoop, V);
   }
 
    };
@@ -286,5 +1349,349 @@
  char LICM::ID = 0;
  RegisterPass<LICM> X("licm-pass", "LICM Pass");
 
+   // Clones an innermost loop for both outcomes of a branch on a loop
+   // invariant condition. The preheader picks the copy once and each
+   // copy sees the condition as a constant.
+   struct LoopUnswitch : public LoopPass {
+     static char ID;
+     LoopUnswitch() : LoopPass(ID) {}
+
+     private:
+     LoopInfo* LI;
+     DominatorTree* DT;
+
+     virtual bool runOnLoop(Loop *L, LPPassManager &LPM)
+     {
+          LI = &getAnalysis<LoopInfo>();
+          DT = &getAnalysis<DominatorTree>();
+
+          //Cloning whole nests grows the code too fast
+          if (!L->empty() || !L->getLoopPreheader())
+            return false;
+
+          if (!canClone(L) || !isLCSSA(L))
+            return false;
+
+          BranchInst *BI = findInvariantBranch(L);
+          if (!BI)
+            return false;
+
+          unswitchLoop(L, BI->getCondition(), LPM);
+          ++NumUnswitched;
+          return true;
+     }
+
+     virtual void getAnalysisUsage(AnalysisUsage &AU) const {
+       AU.addRequired<LoopInfo>();
+       AU.addRequired<DominatorTree>();
+       AU.addPreserved<LoopInfo>();
+       AU.addPreserved<DominatorTree>();
+     }
+
+     // Size budget and blocks we are not able to duplicate
+     bool canClone(Loop *L)
+     {
+        unsigned size = 0;
+        for (Loop::block_iterator b = L->block_begin(), be = L->block_end(); b != be; ++b)
+        {
+          if ((*b)->hasAddressTaken() || isa<IndirectBrInst>((*b)->getTerminator()))
+            return false;
+          for (BasicBlock::iterator i = (*b)->begin(), ie = (*b)->end(); i != ie; ++i)
+          {
+            if (CallInst *CI = dyn_cast<CallInst>(i))
+              if (CI->cannotDuplicate())
+                return false;
+            ++size;
+          }
+        }
+        if (size > UnswitchThreshold)
+          return false;
+
+        SmallVector<BasicBlock*, 8> ExitBlocks;
+        L->getUniqueExitBlocks(ExitBlocks);
+        for (unsigned i = 0, e = ExitBlocks.size(); i != e; ++i)
+          if (ExitBlocks[i]->isLandingPad())
+            return false;
+        return true;
+     }
+
+     // Values of the loop may only leave it through phis in the exit
+     // blocks, those are the only places where the copies merge again
+     bool isLCSSA(Loop *L)
+     {
+        for (Loop::block_iterator b = L->block_begin(), be = L->block_end(); b != be; ++b)
+          for (BasicBlock::iterator i = (*b)->begin(), ie = (*b)->end(); i != ie; ++i)
+            for (Value::use_iterator UI = i->use_begin(), UE = i->use_end(); UI != UE; ++UI)
+            {
+              Instruction *User = cast<Instruction>(*UI);
+              BasicBlock *UseBlock = User->getParent();
+              if (PHINode *PN = dyn_cast<PHINode>(User))
+                UseBlock = PN->getIncomingBlock(UI.getUse());
+              if (!L->contains(UseBlock))
+                return false;
+            }
+        return true;
+     }
+
+     BranchInst* findInvariantBranch(Loop *L)
+     {
+        for (Loop::block_iterator b = L->block_begin(), be = L->block_end(); b != be; ++b)
+        {
+          BranchInst *BI = dyn_cast<BranchInst>((*b)->getTerminator());
+          if (!BI || !BI->isConditional())
+            continue;
+          if (BI->getSuccessor(0) == BI->getSuccessor(1))
+            continue;
+          Value *Cond = BI->getCondition();
+          if (isa<Constant>(Cond) || !isInvariantInLoop(L, Cond))
+            continue;
+          return BI;
+        }
+        return NULL;
+     }
+
+     // Replace the uses of Cond inside L by the constant Val
+     void setConditionInLoop(Loop *L, Value *Cond, Constant *Val)
+     {
+        SmallVector<Use*, 8> Uses;
+        for (Value::use_iterator UI = Cond->use_begin(), UE = Cond->use_end(); UI != UE; ++UI)
+          if (Instruction *User = dyn_cast<Instruction>(*UI))
+            if (L->contains(User))
+              Uses.push_back(&UI.getUse());
+        for (unsigned i = 0, e = Uses.size(); i != e; ++i)
+          Uses[i]->set(Val);
+     }
+
+     void unswitchLoop(Loop *L, Value *Cond, LPPassManager &LPM)
+     {
+        Function *F = L->getHeader()->getParent();
+        Loop *ParentLoop = L->getParentLoop();
+
+        //Give every exit edge a block of its own, the copy of the loop
+        //gets a clone of it that feeds the same exit phis
+        SmallVector<BasicBlock*, 8> ExitBlocks;
+        L->getUniqueExitBlocks(ExitBlocks);
+        for (unsigned i = 0, e = ExitBlocks.size(); i != e; ++i)
+        {
+          SmallVector<BasicBlock*, 4> Preds;
+          for (pred_iterator PI = pred_begin(ExitBlocks[i]), PE = pred_end(ExitBlocks[i]); PI != PE; ++PI)
+            if (L->contains(*PI) && find(Preds.begin(), Preds.end(), *PI) == Preds.end())
+              Preds.push_back(*PI);
+          for (unsigned j = 0, je = Preds.size(); j != je; ++j)
+            SplitBlockPredecessors(ExitBlocks[i], Preds[j], ".us-lcssa", this);
+        }
+
+        //The old preheader keeps the unswitched branch
+        BasicBlock *OldPreheader = L->getLoopPreheader();
+        BasicBlock *NewPreheader = SplitBlock(OldPreheader, OldPreheader->getTerminator(), this);
+
+        SmallVector<BasicBlock*, 8> ExitSplits;
+        L->getUniqueExitBlocks(ExitSplits);
+
+        SmallVector<BasicBlock*, 16> Blocks;
+        Blocks.push_back(NewPreheader);
+        Blocks.append(L->block_begin(), L->block_end());
+        Blocks.append(ExitSplits.begin(), ExitSplits.end());
+
+        ValueToValueMapTy VMap;
+        SmallVector<BasicBlock*, 16> NewBlocks;
+        for (unsigned i = 0, e = Blocks.size(); i != e; ++i)
+        {
+          BasicBlock *NewBB = CloneBasicBlock(Blocks[i], VMap, ".us", F);
+          VMap[Blocks[i]] = NewBB;
+          NewBlocks.push_back(NewBB);
+          LPM.cloneBasicBlockSimpleAnalysis(Blocks[i], NewBB, L);
+        }
+
+        //The header is the first block of L, so it also heads the copy
+        Loop *NewLoop = new Loop();
+        LPM.insertLoop(NewLoop, ParentLoop);
+        for (Loop::block_iterator b = L->block_begin(), be = L->block_end(); b != be; ++b)
+          NewLoop->addBasicBlockToLoop(cast<BasicBlock>(VMap[*b]), LI->getBase());
+        if (ParentLoop)
+        {
+          ParentLoop->addBasicBlockToLoop(cast<BasicBlock>(VMap[NewPreheader]), LI->getBase());
+          for (unsigned i = 0, e = ExitSplits.size(); i != e; ++i)
+            if (Loop *ExitLoop = LI->getLoopFor(ExitSplits[i]))
+              ExitLoop->addBasicBlockToLoop(cast<BasicBlock>(VMap[ExitSplits[i]]), LI->getBase());
+        }
+
+        for (unsigned i = 0, e = NewBlocks.size(); i != e; ++i)
+          for (BasicBlock::iterator I = NewBlocks[i]->begin(), IE = NewBlocks[i]->end(); I != IE; ++I)
+            RemapInstruction(I, VMap, RF_NoModuleLevelChanges | RF_IgnoreMissingEntries);
+
+        //The exit phis receive the copy's value through the cloned edge
+        for (unsigned i = 0, e = ExitSplits.size(); i != e; ++i)
+        {
+          BasicBlock *Succ = ExitSplits[i]->getTerminator()->getSuccessor(0);
+          BasicBlock *NewSplit = cast<BasicBlock>(VMap[ExitSplits[i]]);
+          for (BasicBlock::iterator BI = Succ->begin(); PHINode *PN = dyn_cast<PHINode>(BI); ++BI)
+          {
+            Value *V = PN->getIncomingValueForBlock(ExitSplits[i]);
+            ValueToValueMapTy::iterator It = VMap.find(V);
+            if (It != VMap.end())
+              V = It->second;
+            PN->addIncoming(V, NewSplit);
+          }
+        }
+
+        //Pick the copy once, before either loop is entered
+        OldPreheader->getTerminator()->eraseFromParent();
+        BranchInst::Create(NewPreheader, cast<BasicBlock>(VMap[NewPreheader]), Cond, OldPreheader);
+
+        //The branches on Cond become constant. They are folded by the
+        //CFG cleanup of dce-pass, which keeps LoopInfo out of it here.
+        setConditionInLoop(L, Cond, ConstantInt::getTrue(F->getContext()));
+        setConditionInLoop(NewLoop, Cond, ConstantInt::getFalse(F->getContext()));
+
+        DT->runOnFunction(*F);
+     }
+
+   };
+
+ char LoopUnswitch::ID = 0;
+ RegisterPass<LoopUnswitch> Y("unswitch-pass", "Loop Unswitching Pass");
+
+   // Rewrites multiplies of a basic induction variable by a loop
+   // invariant into an add carried by a new header phi
+   struct IVStrengthReduce : public LoopPass {
+     static char ID;
+     IVStrengthReduce() : LoopPass(ID) {}
+
+     private:
+     // Phi = phi [Start, preheader], [Inc, latch] with Inc = Phi +/- Step
+     struct InductionVar {
+       PHINode *Phi;
+       Value *Start;
+       Value *Step;
+       BinaryOperator *Inc;
+     };
+
+     BasicBlock *Preheader;
+     BasicBlock *Latch;
+
+     virtual bool runOnLoop(Loop *L, LPPassManager &LPM)
+     {
+          Preheader = L->getLoopPreheader();
+          Latch = L->getLoopLatch();
+          if (!Preheader || !Latch)
+            return false;
+
+          SmallVector<InductionVar, 8> IVs;
+          for (BasicBlock::iterator i = L->getHeader()->begin(); PHINode *PN = dyn_cast<PHINode>(i); ++i)
+          {
+            InductionVar IV;
+            if (getInductionVar(L, PN, IV))
+              IVs.push_back(IV);
+          }
+
+          bool changed = false;
+          //The new phis are induction variables as well, so a product
+          //of several factors is reduced one multiply at a time
+          for (unsigned n = 0; n != IVs.size(); ++n)
+          {
+            InductionVar IV = IVs[n];
+            SmallVector<pair<BinaryOperator*, Value*>, 8> Candidates;
+            for (Value::use_iterator UI = IV.Phi->use_begin(), UE = IV.Phi->use_end(); UI != UE; ++UI)
+              if (BinaryOperator *BO = dyn_cast<BinaryOperator>(*UI))
+                if (L->contains(BO))
+                  if (Value *Scale = getScale(L, BO, IV.Phi))
+                    Candidates.push_back(make_pair(BO, Scale));
+
+            for (unsigned i = 0, e = Candidates.size(); i != e; ++i)
+            {
+              IVs.push_back(reduce(L, IV, Candidates[i].first, Candidates[i].second));
+              ++NumStrengthReduced;
+              changed = true;
+            }
+          }
+          return changed;
+     }
+
+     virtual void getAnalysisUsage(AnalysisUsage &AU) const {
+       AU.setPreservesCFG();
+       AU.addRequired<LoopInfo>();
+       AU.addPreserved<LoopInfo>();
+     }
+
+     bool getInductionVar(Loop *L, PHINode *PN, InductionVar &IV)
+     {
+        if (PN->getNumIncomingValues() != 2 || !PN->getType()->isIntegerTy())
+          return false;
+        int PreIdx = PN->getBasicBlockIndex(Preheader);
+        int LatchIdx = PN->getBasicBlockIndex(Latch);
+        if (PreIdx < 0 || LatchIdx < 0)
+          return false;
+
+        BinaryOperator *Inc = dyn_cast<BinaryOperator>(PN->getIncomingValue(LatchIdx));
+        if (!Inc || !L->contains(Inc))
+          return false;
+
+        Value *Step = NULL;
+        if (Inc->getOpcode() == Instruction::Add)
+        {
+          if (Inc->getOperand(0) == PN)
+            Step = Inc->getOperand(1);
+          else if (Inc->getOperand(1) == PN)
+            Step = Inc->getOperand(0);
+        }
+        else if (Inc->getOpcode() == Instruction::Sub && Inc->getOperand(0) == PN)
+          Step = Inc->getOperand(1);
+
+        if (!Step || !isInvariantInLoop(L, Step))
+          return false;
+
+        IV.Phi = PN;
+        IV.Start = PN->getIncomingValue(PreIdx);
+        IV.Step = Step;
+        IV.Inc = Inc;
+        return true;
+     }
+
+     // The invariant factor of BO = Phi * Scale, NULL for anything else
+     Value* getScale(Loop *L, BinaryOperator *BO, PHINode *Phi)
+     {
+        if (BO->getOpcode() == Instruction::Mul)
+        {
+          Value *Other = BO->getOperand(0) == Phi ? BO->getOperand(1) : BO->getOperand(0);
+          if (Other != Phi && isInvariantInLoop(L, Other))
+            return Other;
+        }
+        else if (BO->getOpcode() == Instruction::Shl && BO->getOperand(0) == Phi)
+        {
+          ConstantInt *Amt = dyn_cast<ConstantInt>(BO->getOperand(1));
+          if (Amt && Amt->getValue().ult(Amt->getBitWidth()))
+            return ConstantExpr::getShl(ConstantInt::get(BO->getType(), 1), Amt);
+        }
+        return NULL;
+     }
+
+     // Replace BO = IV * Scale by a phi starting at Start * Scale that
+     // advances by Step * Scale wherever IV advances by Step. Wrapping
+     // arithmetic keeps both forms equal, so no flags are carried over.
+     InductionVar reduce(Loop *L, const InductionVar &IV, BinaryOperator *BO, Value *Scale)
+     {
+        IRBuilder<> Builder(Preheader->getTerminator());
+        Value *Start = Builder.CreateMul(IV.Start, Scale, BO->getName() + ".start");
+        Value *Step = Builder.CreateMul(IV.Step, Scale, BO->getName() + ".step");
+
+        PHINode *NewPhi = PHINode::Create(BO->getType(), 2, BO->getName() + ".sr", L->getHeader()->begin());
+        BinaryOperator *Next = BinaryOperator::Create(IV.Inc->getOpcode(), NewPhi, Step,
+                                                      BO->getName() + ".next", Latch->getTerminator());
+        NewPhi->addIncoming(Start, Preheader);
+        NewPhi->addIncoming(Next, Latch);
+
+        BO->replaceAllUsesWith(NewPhi);
+        BO->eraseFromParent();
+
+        InductionVar NewIV = { NewPhi, Start, Step, Next };
+        return NewIV;
+     }
+
+   };
+
+ char IVStrengthReduce::ID = 0;
+ RegisterPass<IVStrengthReduce> Z("ivsr-pass", "Induction Variable Strength Reduction Pass");
+
 }
 
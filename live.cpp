@@ -12,7 +12,10 @@
 #include "llvm/Support/FormattedStream.h"
 #include "llvm/Assembly/AssemblyAnnotationWriter.h"
 #include "llvm/DebugInfo.h"
+#include "llvm/Support/CommandLine.h"
 #include "DFAFramework.cpp"
+#include "LiveIntervals.cpp"
+#include "AnalysisExport.cpp"
 #include <map>
 #include <set>
 #include <ostream>
@@ -22,6 +25,18 @@
 using namespace llvm;
 using namespace std;
 
+static cl::opt<bool> PrintIntervals("live-intervals", cl::init(false),
+  cl::desc("Print live intervals over numbered instructions instead of the live sets"));
+
+static cl::opt<std::string> ExportFile("live-export", cl::init(""),
+  cl::desc("Write the live sets to this file instead of printing the annotated IR"));
+
+static cl::opt<AnalysisExporter::Format> ExportFormat("live-export-format", cl::init(AnalysisExporter::Binary),
+  cl::desc("Format of the -live-export file"),
+  cl::values(clEnumValN(AnalysisExporter::Binary, "binary", "Little endian records that can be mapped in place"),
+             clEnumValN(AnalysisExporter::JSON, "json", "One JSON object per function and line"),
+             clEnumValEnd));
+
 namespace {
 
 
@@ -76,11 +91,32 @@ namespace {
   };
 
 
+  // Numbers every instruction and lists the values live before it,
+  // as answered by the live intervals
+  class IntervalAnnotator : public AssemblyAnnotationWriter {
+  public:
+    LiveIntervals &intervals;
+
+    IntervalAnnotator(LiveIntervals &li) : intervals(li) {}
+
+    virtual void emitInstructionAnnot(const Instruction *i, formatted_raw_ostream &os) {
+      unsigned number = intervals.getNumber(i);
+      SmallVector<Value*, 16> live;
+      intervals.getLiveAt(LiveIntervals::getSlotBefore(number), live);
+      os << "; " << number << ": ";
+      for (unsigned v = 0, ve = live.size(); v != ve; ++v)
+        os << live[v]->getName() << ", ";
+      os << "\n";
+    }
+  };
+
+
   class FunctionInfo : public FunctionPass, public DFAFramework<BitVector> {
 
   public:
     static char ID;
-    FunctionInfo() : FunctionPass(ID), DFAFramework(false){}
+    FunctionInfo() : FunctionPass(ID), DFAFramework(false), Exporter("live", ExportFile, ExportFormat){}
+    AnalysisExporter Exporter;
 
     //modifies the appropriate set based on the direction of analysis
     virtual void transferFunction(BasicBlock* block){
@@ -131,6 +167,19 @@ namespace {
     virtual bool runOnFunction(Function  &F){
       analyze(F);
       //printValuesInFormat();
+      if (PrintIntervals) {
+        LiveIntervals intervals;
+        intervals.build(F, valueIndexMap, blockFlowDataMap);
+        errs() << "live intervals of " << F.getName() << ":\n";
+        intervals.print(errs());
+        IntervalAnnotator anno(intervals);
+        F.print(errs(), &anno);
+        return false;
+      }
+      if (Exporter.enabled()) {
+        Exporter.exportFunction(F, valueIndexMap, blockFlowDataMap, instructionFlowDataMap);
+        return false;
+      }
       Annotator anno(blockFlowDataMap,instructionFlowDataMap,valueIndexMap);
       F.print(errs(),&anno);
       return false;
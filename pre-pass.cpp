@@ -0,0 +1,413 @@
+#include "llvm/Pass.h"
+#include "llvm/Support/CFG.h"
+#include "llvm/Support/InstIterator.h"
+#include "llvm/PassManager.h"
+#include "llvm/Transforms/IPO/PassManagerBuilder.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/ValueMap.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/SSAUpdater.h"
+#include "ForwardAnalyses.cpp"
+#include <map>
+#include <vector>
+
+using namespace llvm;
+using namespace std;
+
+STATISTIC(NumInserted, "Number of computations inserted by lazy code motion");
+STATISTIC(NumReplaced, "Number of computations replaced by lazy code motion");
+STATISTIC(NumEdgesSplit, "Number of critical edges split for lazy code motion");
+
+namespace {
+
+  /**
+   * Block level sets of lazy code motion, one bit per class of
+   * instructions computing the same expression.
+   * use[B]  - the expression is computed in B, its operands are
+   *           defined before B (upward exposed)
+   * kill[B] - B defines an operand of the expression
+   */
+  struct LCMSets {
+    map<BasicBlock*, BitVector> use;
+    map<BasicBlock*, BitVector> kill;
+    map<BasicBlock*, BitVector> earliest;
+    map<BasicBlock*, BitVector> latest;
+  };
+
+  /**
+   * One of the bit vector problems of lazy code motion on top of
+   * DFAFramework. Only the block values are used. Blocks on the
+   * boundary (entry going forward, exits going backward) keep the
+   * value set by setBoundaryConditions, every other block starts at
+   * the top of its meet.
+   */
+  class LCMProblem : public DFAFramework<BitVector> {
+  public:
+    LCMProblem(bool forward, bool intersect, LCMSets &sets)
+      : DFAFramework<BitVector>(forward), S(sets), intersect(intersect), entryBlock(NULL) {}
+
+    void run(Function &F) {
+      entryBlock = &F.getEntryBlock();
+      analyze(F);
+    }
+
+    BitVector& in(BasicBlock *B) { return *(blockFlowDataMap[B]->in); }
+    BitVector& out(BasicBlock *B) { return *(blockFlowDataMap[B]->out); }
+
+    virtual void meet(BasicBlock* block) {
+      BitVector *target;
+      bool first = true;
+      if (direction) {
+        if (block == entryBlock || pred_begin(block) == pred_end(block))
+          return;
+        target = blockFlowDataMap[block]->in;
+        for (pred_iterator PI = pred_begin(block), E = pred_end(block); PI != E; ++PI) {
+          meetInto(*target, out(*PI), first);
+          first = false;
+        }
+      } else {
+        if (succ_begin(block) == succ_end(block))
+          return;
+        target = blockFlowDataMap[block]->out;
+        for (succ_iterator SI = succ_begin(block), E = succ_end(block); SI != E; ++SI) {
+          meetInto(*target, in(*SI), first);
+          first = false;
+        }
+      }
+    }
+
+    virtual void setInitialFlowValues() {
+      for (ValueMap<BasicBlock*, BasicBlockAnalysisData<BitVector>*>::iterator it = blockFlowDataMap.begin(), ite = blockFlowDataMap.end(); it != ite; it++) {
+        if (intersect) {
+          it->second->in->set();
+          it->second->out->set();
+        } else {
+          it->second->in->reset();
+          it->second->out->reset();
+        }
+      }
+    }
+
+    // Nothing is known before the entry or after the exits
+    virtual void setBoundaryConditions() {
+      for (ValueMap<BasicBlock*, BasicBlockAnalysisData<BitVector>*>::iterator it = blockFlowDataMap.begin(), ite = blockFlowDataMap.end(); it != ite; it++) {
+        BasicBlock *B = it->first;
+        if (direction && (B == entryBlock || pred_begin(B) == pred_end(B)))
+          it->second->in->reset();
+        if (!direction && succ_begin(B) == succ_end(B))
+          it->second->out->reset();
+      }
+    }
+
+    // Only block values are needed
+    void pushResultsFromBlockToInstructions(ValueMap<BasicBlock*, BasicBlockAnalysisData<BitVector>*> &blockFlowDataMap,ValueMap<Value*, InstructionAnalysisData<BitVector>*> &instructionFlowDataMap) {}
+
+    void initializePHINodeMaskValues(map<pair<BasicBlock*, BasicBlock*>, BitVector*> &phiNodeMask,ValueMap<BasicBlock*, BasicBlockAnalysisData<BitVector>*> &blockFlowDataMap,ValueMap<Value *, int> &valueIndexMap,Function &F) {}
+
+    virtual void printFlowValue(BitVector *bv, bool newLine) {
+      for (unsigned bit = 0; bit < bv->size(); bit++)
+        errs() << (bv->test(bit) ? '1' : '0');
+      if(newLine) errs() << "\n";
+    }
+
+    virtual void printValuesInFormat() {
+      printBlockFlowDataMap(blockFlowDataMap);
+    }
+
+  protected:
+    LCMSets &S;
+    bool intersect;
+    BasicBlock *entryBlock;
+
+    void meetInto(BitVector &target, BitVector &value, bool first) {
+      if (first)
+        target = value;
+      else if (intersect)
+        target &= value;
+      else
+        target |= value;
+    }
+  };
+
+  // in[B] = use[B] U (out[B] - kill[B]), out[B] = ^ in[Succ]
+  class Anticipated : public LCMProblem {
+  public:
+    Anticipated(LCMSets &sets) : LCMProblem(false, true, sets) {}
+
+    virtual void transferFunction(BasicBlock* block) {
+      BitVector value = S.kill[block];
+      value.flip();
+      value &= out(block);
+      value |= S.use[block];
+      in(block) = value;
+    }
+  };
+
+  // out[B] = (anticipated.in[B] U in[B]) - kill[B], in[B] = ^ out[Pred]
+  class WillBeAvailable : public LCMProblem {
+  public:
+    WillBeAvailable(LCMSets &sets, Anticipated &ant) : LCMProblem(true, true, sets), Ant(ant) {}
+
+    virtual void transferFunction(BasicBlock* block) {
+      BitVector value = Ant.in(block);
+      value |= in(block);
+      BitVector notKilled = S.kill[block];
+      notKilled.flip();
+      value &= notKilled;
+      out(block) = value;
+    }
+
+  private:
+    Anticipated &Ant;
+  };
+
+  // out[B] = (earliest[B] U in[B]) - use[B], in[B] = ^ out[Pred]
+  class Postponable : public LCMProblem {
+  public:
+    Postponable(LCMSets &sets) : LCMProblem(true, true, sets) {}
+
+    virtual void transferFunction(BasicBlock* block) {
+      BitVector value = S.earliest[block];
+      value |= in(block);
+      BitVector notUsed = S.use[block];
+      notUsed.flip();
+      value &= notUsed;
+      out(block) = value;
+    }
+  };
+
+  // in[B] = (use[B] U out[B]) - latest[B], out[B] = U in[Succ]
+  class Used : public LCMProblem {
+  public:
+    Used(LCMSets &sets) : LCMProblem(false, false, sets) {}
+
+    virtual void transferFunction(BasicBlock* block) {
+      BitVector value = S.use[block];
+      value |= out(block);
+      BitVector notLatest = S.latest[block];
+      notLatest.flip();
+      value &= notLatest;
+      in(block) = value;
+    }
+  };
+
+
+  // Partial redundancy elimination by lazy code motion. Every pure
+  // expression is computed as late as possible on the paths that need
+  // it and at most once per path.
+  class LazyCodeMotion : public FunctionPass {
+  public:
+    static char ID;
+    LazyCodeMotion() : FunctionPass(ID) {}
+
+  private:
+    //Instructions of each expression class, the first one is the model
+    vector<vector<Instruction*> > classes;
+    LCMSets S;
+    //Values made in the current round
+    SmallPtrSet<Value*, 32> placed;
+    bool changed;
+    //Bound on the rounds for expressions over moved expressions
+    static const unsigned MaxRounds = 8;
+
+    virtual bool runOnFunction(Function &F) {
+      changed = false;
+      splitCriticalEdges(F);
+
+      for (unsigned round = 0; round != MaxRounds; ++round)
+        if (!runRound(F))
+          break;
+      return changed;
+    }
+
+    // One solution of the four problems and the moves it allows.
+    // Returns true if any expression was moved.
+    bool runRound(Function &F) {
+      collectExpressions(F);
+      if (classes.empty())
+        return false;
+      computeLocalSets(F);
+
+      Anticipated Ant(S);
+      Ant.run(F);
+      WillBeAvailable Avail(S, Ant);
+      Avail.run(F);
+
+      // earliest[B] = anticipated.in[B] - available.in[B]
+      for (Function::iterator b = F.begin(), be = F.end(); b != be; b++) {
+        BitVector value = Avail.in(b);
+        value.flip();
+        value &= Ant.in(b);
+        S.earliest[b] = value;
+      }
+
+      Postponable Post(S);
+      Post.run(F);
+
+      // latest[B] = (earliest[B] U postponable.in[B]) ^
+      //             (use[B] U ~(^ (earliest[Succ] U postponable.in[Succ])))
+      for (Function::iterator b = F.begin(), be = F.end(); b != be; b++) {
+        BitVector value = S.earliest[b];
+        value |= Post.in(b);
+        BitVector later(value.size(), true);
+        for (succ_iterator SI = succ_begin(b), E = succ_end(b); SI != E; ++SI) {
+          BitVector succValue = S.earliest[*SI];
+          succValue |= Post.in(*SI);
+          later &= succValue;
+        }
+        later.flip();
+        later |= S.use[b];
+        value &= later;
+        S.latest[b] = value;
+      }
+
+      Used Use(S);
+      Use.run(F);
+
+      bool moved = false;
+      placed.clear();
+      for (unsigned c = 0, e = classes.size(); c != e; ++c)
+        moved |= moveExpression(F, c, Use);
+
+      classes.clear();
+      S.use.clear();
+      S.kill.clear();
+      S.earliest.clear();
+      S.latest.clear();
+      return moved;
+    }
+
+    // Computations are placed at the start of blocks, so every edge
+    // into a join has to get a block of its own
+    void splitCriticalEdges(Function &F) {
+      for (Function::iterator b = F.begin(), be = F.end(); b != be; b++) {
+        TerminatorInst *TI = b->getTerminator();
+        if (TI->getNumSuccessors() < 2)
+          continue;
+        for (unsigned i = 0, e = TI->getNumSuccessors(); i != e; ++i)
+          if (isCriticalEdge(TI, i) && SplitCriticalEdge(TI, i, this)) {
+            ++NumEdgesSplit;
+            changed = true;
+          }
+      }
+    }
+
+    // Group the expressions that can be moved freely. Trapping ones
+    // could fault earlier than before, so they stay where they are.
+    void collectExpressions(Function &F) {
+      map<AvailableExpressions::ExpressionKey, unsigned> classOf;
+      for (inst_iterator i = inst_begin(F), e = inst_end(F); i != e; i++) {
+        Instruction *I = &*i;
+        if (!AvailableExpressions::isExpression(I) || !isSafeToSpeculativelyExecute(I))
+          continue;
+        AvailableExpressions::ExpressionKey key = AvailableExpressions::getKey(I);
+        map<AvailableExpressions::ExpressionKey, unsigned>::iterator it = classOf.find(key);
+        if (it == classOf.end()) {
+          it = classOf.insert(make_pair(key, (unsigned)classes.size())).first;
+          classes.push_back(vector<Instruction*>());
+        }
+        classes[it->second].push_back(I);
+      }
+    }
+
+    // Same size as the flow values of DFAFramework, one bit per
+    // argument and instruction; the classes use the first bits
+    void computeLocalSets(Function &F) {
+      unsigned size = F.arg_size();
+      for (inst_iterator i = inst_begin(F), e = inst_end(F); i != e; i++)
+        size++;
+
+      for (Function::iterator b = F.begin(), be = F.end(); b != be; b++) {
+        S.use[b] = BitVector(size);
+        S.kill[b] = BitVector(size);
+      }
+
+      for (unsigned c = 0, e = classes.size(); c != e; ++c) {
+        Instruction *Model = classes[c][0];
+        for (User::op_iterator OI = Model->op_begin(), OE = Model->op_end(); OI != OE; ++OI)
+          if (Instruction *Op = dyn_cast<Instruction>(*OI))
+            S.kill[Op->getParent()].set(c);
+        for (unsigned i = 0, ie = classes[c].size(); i != ie; ++i) {
+          BasicBlock *B = classes[c][i]->getParent();
+          if (!S.kill[B].test(c))
+            S.use[B].set(c);
+        }
+      }
+    }
+
+    // Insert the expression where latest and used say so and replace
+    // the upward exposed computations by the value that reaches them.
+    // The sets of an expression over a value moved in this round are
+    // stale, it waits for the next round.
+    bool moveExpression(Function &F, unsigned c, Used &Use) {
+      vector<Instruction*> &members = classes[c];
+      Instruction *Model = members[0];
+
+      for (unsigned i = 0, e = members.size(); i != e; ++i)
+        for (User::op_iterator OI = members[i]->op_begin(), OE = members[i]->op_end(); OI != OE; ++OI)
+          if (placed.count(*OI))
+            return false;
+
+      bool sameFlags = true;
+      for (unsigned i = 1, e = members.size(); i != e; ++i)
+        if (members[i]->getRawSubclassOptionalData() != Model->getRawSubclassOptionalData())
+          sameFlags = false;
+
+      map<BasicBlock*, Instruction*> inserted;
+      SmallVector<PHINode*, 8> NewPHIs;
+      SSAUpdater SSA(&NewPHIs);
+      SSA.Initialize(Model->getType(), Model->getName());
+
+      for (Function::iterator b = F.begin(), be = F.end(); b != be; b++) {
+        if (!S.latest[b].test(c) || !Use.out(b).test(c))
+          continue;
+        Instruction *T = Model->clone();
+        //Flags only hold when every computation had them
+        if (!sameFlags)
+          T->clearSubclassOptionalData();
+        if (Model->hasName())
+          T->setName(Model->getName() + ".lcm");
+        T->insertBefore(b->getFirstInsertionPt());
+        inserted[b] = T;
+        placed.insert(T);
+        SSA.AddAvailableValue(b, T);
+        ++NumInserted;
+      }
+
+      bool moved = !inserted.empty();
+
+      for (unsigned i = 0, e = members.size(); i != e; ++i) {
+        Instruction *I = members[i];
+        BasicBlock *B = I->getParent();
+        if (!S.use[B].test(c))
+          continue;
+        //Computed in place when this is the latest point and nothing later needs it
+        if (S.latest[B].test(c) && !Use.out(B).test(c))
+          continue;
+
+        map<BasicBlock*, Instruction*>::iterator it = inserted.find(B);
+        Value *V = it != inserted.end() ? it->second : SSA.GetValueInMiddleOfBlock(B);
+        I->replaceAllUsesWith(V);
+        I->eraseFromParent();
+        ++NumReplaced;
+        moved = true;
+      }
+
+      for (unsigned i = 0, e = NewPHIs.size(); i != e; ++i)
+        placed.insert(NewPHIs[i]);
+      changed |= moved;
+      return moved;
+    }
+  };
+
+char LazyCodeMotion::ID = 0;
+RegisterPass<LazyCodeMotion> X("pre-pass", "Lazy Code Motion Pass");
+}
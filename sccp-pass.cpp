@@ -0,0 +1,280 @@
+#include "llvm/Pass.h"
+#include "llvm/Support/CFG.h"
+#include "llvm/Support/InstIterator.h"
+#include "llvm/PassManager.h"
+#include "llvm/Transforms/IPO/PassManagerBuilder.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/Module.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Analysis/ConstantFolding.h"
+#include "Lattice.cpp"
+#include "CFGCleanup.cpp"
+#include <map>
+#include <set>
+#include <vector>
+
+using namespace llvm;
+using namespace std;
+
+STATISTIC(NumInstRemoved, "Number of instructions replaced by constants");
+STATISTIC(NumBranchesFolded, "Number of branches folded to a single successor");
+STATISTIC(NumDeadBlocks, "Number of blocks found never to execute");
+
+namespace {
+
+  typedef LatticeValue<Constant*> ConstantLattice;
+
+  /**
+   * Sparse conditional constant propagation solver. Values
+   * are lowered along SSA edges, blocks only count once an
+   * edge into them is known to be taken.
+   */
+  class SCCPSolver {
+  public:
+    SCCPSolver(const DataLayout *TD) : TD(TD) {}
+
+    void solve(Function &F) {
+      markBlockExecutable(&F.getEntryBlock());
+      do {
+        run();
+      } while (resolveUndefinedBranches(F));
+    }
+
+    ConstantLattice getValue(Value *V) {
+      if (Constant *C = dyn_cast<Constant>(V)) {
+        //Any value may be picked for undef, keep it unknown
+        if (isa<UndefValue>(C))
+          return ConstantLattice::getOverdefined();
+        return ConstantLattice::getConstant(C);
+      }
+      if (!isa<Instruction>(V))
+        return ConstantLattice::getOverdefined();
+      map<Value*, ConstantLattice>::iterator it = values.find(V);
+      if (it == values.end())
+        return ConstantLattice();
+      return it->second;
+    }
+
+    bool isExecutable(BasicBlock *BB) {
+      return executable.count(BB);
+    }
+
+  private:
+    const DataLayout *TD;
+    map<Value*, ConstantLattice> values;
+    SmallPtrSet<BasicBlock*, 32> executable;
+    set<pair<BasicBlock*, BasicBlock*> > feasibleEdges;
+    SmallVector<BasicBlock*, 32> blockWorkList;
+    SmallVector<Instruction*, 64> ssaWorkList;
+
+    void run() {
+      while (!blockWorkList.empty() || !ssaWorkList.empty()) {
+        while (!ssaWorkList.empty()) {
+          Instruction *I = ssaWorkList.pop_back_val();
+          if (isExecutable(I->getParent()))
+            visit(I);
+        }
+        while (!blockWorkList.empty()) {
+          BasicBlock *BB = blockWorkList.pop_back_val();
+          for (BasicBlock::iterator I = BB->begin(), E = BB->end(); I != E; ++I)
+            visit(I);
+        }
+      }
+    }
+
+    void markBlockExecutable(BasicBlock *BB) {
+      if (executable.insert(BB))
+        blockWorkList.push_back(BB);
+    }
+
+    void markEdgeFeasible(BasicBlock *From, BasicBlock *To) {
+      if (!feasibleEdges.insert(make_pair(From, To)).second)
+        return;
+      if (isExecutable(To)) {
+        //Only the phis see the new edge
+        for (BasicBlock::iterator I = To->begin(); isa<PHINode>(I); ++I)
+          ssaWorkList.push_back(I);
+        return;
+      }
+      markBlockExecutable(To);
+    }
+
+    void update(Instruction *I, const ConstantLattice &V) {
+      if (!values[I].meet(V))
+        return;
+      for (Value::use_iterator UI = I->use_begin(), UE = I->use_end(); UI != UE; ++UI)
+        if (Instruction *User = dyn_cast<Instruction>(*UI))
+          ssaWorkList.push_back(User);
+    }
+
+    void visit(Instruction *I) {
+      if (PHINode *PN = dyn_cast<PHINode>(I))
+        visitPHI(PN);
+      else if (TerminatorInst *TI = dyn_cast<TerminatorInst>(I))
+        visitTerminator(TI);
+      else if (I->getType()->isVoidTy())
+        return;
+      else if (isa<BinaryOperator>(I) || isa<CastInst>(I) || isa<CmpInst>(I) || isa<GetElementPtrInst>(I))
+        visitExpression(I);
+      else if (SelectInst *SI = dyn_cast<SelectInst>(I))
+        visitSelect(SI);
+      else
+        update(I, ConstantLattice::getOverdefined());
+    }
+
+    // Meet of the incoming values over the edges taken so far
+    void visitPHI(PHINode *PN) {
+      ConstantLattice result;
+      for (unsigned i = 0, e = PN->getNumIncomingValues(); i != e; ++i)
+        if (feasibleEdges.count(make_pair(PN->getIncomingBlock(i), PN->getParent())))
+          result.meet(getValue(PN->getIncomingValue(i)));
+      update(PN, result);
+    }
+
+    void visitTerminator(TerminatorInst *TI) {
+      BasicBlock *BB = TI->getParent();
+      Value *Cond = NULL;
+      if (BranchInst *BI = dyn_cast<BranchInst>(TI)) {
+        if (BI->isConditional())
+          Cond = BI->getCondition();
+      } else if (SwitchInst *SI = dyn_cast<SwitchInst>(TI))
+        Cond = SI->getCondition();
+
+      if (Cond) {
+        ConstantLattice C = getValue(Cond);
+        if (C.isUndefined())
+          return;
+        if (ConstantInt *CI = dyn_cast_or_null<ConstantInt>(C.isConstant() ? C.getValue() : NULL)) {
+          if (BranchInst *BI = dyn_cast<BranchInst>(TI))
+            markEdgeFeasible(BB, BI->getSuccessor(CI->isZero() ? 1 : 0));
+          else
+            markEdgeFeasible(BB, cast<SwitchInst>(TI)->findCaseValue(CI).getCaseSuccessor());
+          return;
+        }
+      }
+
+      for (unsigned i = 0, e = TI->getNumSuccessors(); i != e; ++i)
+        markEdgeFeasible(BB, TI->getSuccessor(i));
+    }
+
+    // Fold once every operand is a constant
+    void visitExpression(Instruction *I) {
+      SmallVector<Constant*, 4> operands;
+      for (User::op_iterator OI = I->op_begin(), OE = I->op_end(); OI != OE; ++OI) {
+        ConstantLattice V = getValue(*OI);
+        if (V.isOverdefined()) {
+          update(I, V);
+          return;
+        }
+        if (V.isUndefined())
+          return;
+        operands.push_back(V.getValue());
+      }
+
+      Constant *C;
+      if (CmpInst *CI = dyn_cast<CmpInst>(I))
+        C = ConstantFoldCompareInstOperands(CI->getPredicate(), operands[0], operands[1], TD);
+      else
+        C = ConstantFoldInstOperands(I->getOpcode(), I->getType(), operands, TD);
+
+      if (C && !isa<UndefValue>(C))
+        update(I, ConstantLattice::getConstant(C));
+      else
+        update(I, ConstantLattice::getOverdefined());
+    }
+
+    void visitSelect(SelectInst *SI) {
+      ConstantLattice Cond = getValue(SI->getCondition());
+      if (Cond.isUndefined())
+        return;
+      if (Cond.isConstant())
+        if (ConstantInt *CI = dyn_cast<ConstantInt>(Cond.getValue())) {
+          update(SI, getValue(CI->isZero() ? SI->getFalseValue() : SI->getTrueValue()));
+          return;
+        }
+      ConstantLattice result = getValue(SI->getTrueValue());
+      result.meet(getValue(SI->getFalseValue()));
+      update(SI, result);
+    }
+
+    // A branch in a live block whose condition stayed undefined takes
+    // every successor. Returns true if that opened up new edges.
+    bool resolveUndefinedBranches(Function &F) {
+      bool changed = false;
+      for (Function::iterator b = F.begin(), be = F.end(); b != be; b++) {
+        if (!isExecutable(b))
+          continue;
+        TerminatorInst *TI = b->getTerminator();
+        Value *Cond = NULL;
+        if (BranchInst *BI = dyn_cast<BranchInst>(TI)) {
+          if (BI->isConditional())
+            Cond = BI->getCondition();
+        } else if (SwitchInst *SI = dyn_cast<SwitchInst>(TI))
+          Cond = SI->getCondition();
+        if (!Cond || !getValue(Cond).isUndefined())
+          continue;
+        for (unsigned i = 0, e = TI->getNumSuccessors(); i != e; ++i)
+          if (!feasibleEdges.count(make_pair((BasicBlock*)b, TI->getSuccessor(i)))) {
+            markEdgeFeasible(b, TI->getSuccessor(i));
+            changed = true;
+          }
+      }
+      return changed;
+    }
+  };
+
+
+  class SCCP : public FunctionPass {
+  public:
+    static char ID;
+    SCCP() : FunctionPass(ID) {}
+
+    virtual bool runOnFunction(Function &F) {
+      SCCPSolver Solver(getAnalysisIfAvailable<DataLayout>());
+      Solver.solve(F);
+
+      bool changed = false;
+      SmallVector<BasicBlock*, 32> liveBlocks;
+      for (Function::iterator b = F.begin(), be = F.end(); b != be; b++) {
+        if (!Solver.isExecutable(b)) {
+          ++NumDeadBlocks;
+          continue;
+        }
+        liveBlocks.push_back(b);
+
+        for (BasicBlock::iterator II = b->begin(), E = b->end(); II != E; ) {
+          Instruction *I = II++;
+          if (I->getType()->isVoidTy() || isa<TerminatorInst>(I))
+            continue;
+          ConstantLattice V = Solver.getValue(I);
+          if (!V.isConstant())
+            continue;
+          I->replaceAllUsesWith(V.getValue());
+          if (!I->mayHaveSideEffects())
+            I->eraseFromParent();
+          ++NumInstRemoved;
+          changed = true;
+        }
+      }
+
+      //Conditions known to be constant are constants by now, the edges
+      //never taken go away and with them the blocks never executed
+      for (unsigned i = 0, e = liveBlocks.size(); i != e; ++i)
+        if (ConstantFoldTerminator(liveBlocks[i], true)) {
+          ++NumBranchesFolded;
+          changed = true;
+        }
+      changed |= deleteUnreachableBlocks(F);
+      return changed;
+    }
+  };
+
+char SCCP::ID = 0;
+RegisterPass<SCCP> X("sccp-pass", "SCCP Pass");
+}
@@ -0,0 +1,221 @@
+#include "llvm/Pass.h"
+#include "llvm/Support/CFG.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/Support/InstIterator.h"
+#include "llvm/PassManager.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/raw_ostream.h"
+#include "RegPressure.cpp"
+#include <map>
+#include <vector>
+#include <algorithm>
+
+using namespace llvm;
+using namespace std;
+
+STATISTIC(NumBlocksScheduled, "Number of blocks reordered to lower register pressure");
+STATISTIC(NumPressureSaved, "Sum over reordered blocks of the drop in maximum pressure");
+
+static cl::opt<bool> SchedReport("sched-report", cl::init(true),
+  cl::desc("Print the maximum register pressure of every block before and after sched-pass"));
+
+namespace {
+
+  // Bottom up list scheduling inside each block. Starting from the
+  // values live out of the block, the ready instruction that adds the
+  // fewest live values is placed next above the ones placed so far, so
+  // definitions end up next to their first use and uses move up toward
+  // the last use of their operands. Memory and side effect order is
+  // kept. A block is only rewritten if its maximum pressure goes down.
+  class Schedule : public FunctionPass {
+  public:
+    static char ID;
+    Schedule() : FunctionPass(ID) {}
+
+    virtual bool runOnFunction(Function &F) {
+      PressureInfo.compute(F);
+
+      bool changed = false;
+      RegPressure::Pressure before, after;
+      for (Function::iterator b = F.begin(), be = F.end(); b != be; b++) {
+        RegPressure::Pressure blockBefore, blockAfter;
+        changed |= scheduleBlock(b, blockBefore, blockAfter);
+        before.max(blockBefore);
+        after.max(blockAfter);
+        if (SchedReport)
+          report(F.getName() + ":" + b->getName(), blockBefore, blockAfter);
+      }
+      if (SchedReport)
+        report(F.getName(), before, after);
+
+      //Reordered blocks and later passes make the liveness stale
+      PressureInfo.invalidate();
+      return changed;
+    }
+
+    virtual void getAnalysisUsage(AnalysisUsage &AU) const {
+      AU.setPreservesCFG();
+    }
+
+  private:
+    RegPressure PressureInfo;
+
+    void report(const Twine &Where, const RegPressure::Pressure &before, const RegPressure::Pressure &after) {
+      errs() << Where << ": max pressure ";
+      before.print(errs());
+      errs() << " -> ";
+      after.print(errs());
+      errs() << "\n";
+    }
+
+    // Phis, landing pads and the allocas at the top stay put
+    static bool isPinnedAtTop(Instruction *I) {
+      return isa<PHINode>(I) || isa<LandingPadInst>(I) || isa<AllocaInst>(I);
+    }
+
+    // Instructions whose relative order is kept, other than loads
+    // among themselves. Ones that may trap must not move above a
+    // call that might not return.
+    static bool isOrdered(Instruction *I) {
+      return I->mayReadOrWriteMemory() || I->mayHaveSideEffects() || isa<AllocaInst>(I) || isa<DbgInfoIntrinsic>(I) ||
+        !isSafeToSpeculativelyExecute(I);
+    }
+
+    static bool mustStayOrdered(Instruction *Earlier, Instruction *Later) {
+      if (!isOrdered(Earlier) || !isOrdered(Later))
+        return false;
+      return !(isa<LoadInst>(Earlier) && isa<LoadInst>(Later) &&
+               cast<LoadInst>(Earlier)->isUnordered() && cast<LoadInst>(Later)->isUnordered());
+    }
+
+    // Live values after I go up through it: its def dies, its operands
+    // become live
+    void stepUp(Instruction *I, BitVector &live) {
+      LiveAnalysis &Live = PressureInfo.getLiveness();
+      ValueMap<Value *,int>::iterator it = Live.mapValueToBit.find(I);
+      if (it != Live.mapValueToBit.end())
+        live.reset(it->second);
+      for (User::op_iterator OI = I->op_begin(), OE = I->op_end(); OI != OE; ++OI)
+        if (isa<Instruction>(*OI) || isa<Argument>(*OI))
+          live.set(Live.mapValueToBit[*OI]);
+    }
+
+    // Number of values I would make live minus the one it ends
+    int pressureDelta(Instruction *I, BitVector &live) {
+      LiveAnalysis &Live = PressureInfo.getLiveness();
+      int delta = 0;
+      SmallVector<int, 4> seen;
+      for (User::op_iterator OI = I->op_begin(), OE = I->op_end(); OI != OE; ++OI) {
+        if (!isa<Instruction>(*OI) && !isa<Argument>(*OI))
+          continue;
+        int bit = Live.mapValueToBit[*OI];
+        if (!live.test(bit) && std::find(seen.begin(), seen.end(), bit) == seen.end()) {
+          seen.push_back(bit);
+          delta++;
+        }
+      }
+      ValueMap<Value *,int>::iterator it = Live.mapValueToBit.find(I);
+      if (it != Live.mapValueToBit.end() && live.test(it->second))
+        delta--;
+      return delta;
+    }
+
+    // Maximum number of live values between the instructions of order,
+    // which sits between the pinned top and the terminator of BB
+    RegPressure::Pressure maxPressure(BasicBlock *BB, vector<Instruction*> &order) {
+      BitVector live = *(PressureInfo.getLiveness().flowForBB[BB]->out);
+      stepUp(BB->getTerminator(), live);
+      RegPressure::Pressure result = PressureInfo.count(live);
+      for (unsigned i = order.size(); i-- != 0; ) {
+        stepUp(order[i], live);
+        result.max(PressureInfo.count(live));
+      }
+      return result;
+    }
+
+    bool scheduleBlock(BasicBlock *BB, RegPressure::Pressure &before, RegPressure::Pressure &after) {
+      BasicBlock::iterator start = BB->begin();
+      while (isPinnedAtTop(start))
+        ++start;
+      vector<Instruction*> region;
+      for (BasicBlock::iterator I = start, E = BB->getTerminator(); I != E; ++I)
+        region.push_back(I);
+
+      before = after = maxPressure(BB, region);
+      if (region.size() < 2)
+        return false;
+
+      //preds[i] must come before region[i], users[i] counts those
+      //that must come after it
+      map<Instruction*, unsigned> position;
+      for (unsigned i = 0, e = region.size(); i != e; ++i)
+        position[region[i]] = i;
+      vector<SmallVector<unsigned, 4> > preds(region.size());
+      vector<unsigned> users(region.size(), 0);
+      for (unsigned i = 0, e = region.size(); i != e; ++i) {
+        for (User::op_iterator OI = region[i]->op_begin(), OE = region[i]->op_end(); OI != OE; ++OI)
+          if (Instruction *Op = dyn_cast<Instruction>(*OI)) {
+            map<Instruction*, unsigned>::iterator it = position.find(Op);
+            if (it != position.end() && std::find(preds[i].begin(), preds[i].end(), it->second) == preds[i].end())
+              preds[i].push_back(it->second);
+          }
+        for (unsigned j = 0; j != i; ++j)
+          if (mustStayOrdered(region[j], region[i]) && std::find(preds[i].begin(), preds[i].end(), j) == preds[i].end())
+            preds[i].push_back(j);
+        for (unsigned k = 0, ke = preds[i].size(); k != ke; ++k)
+          users[preds[i][k]]++;
+      }
+
+      BitVector live = *(PressureInfo.getLiveness().flowForBB[BB]->out);
+      stepUp(BB->getTerminator(), live);
+      vector<unsigned> ready;
+      for (unsigned i = 0, e = region.size(); i != e; ++i)
+        if (users[i] == 0)
+          ready.push_back(i);
+
+      vector<Instruction*> order(region.size());
+      for (unsigned slot = region.size(); slot-- != 0; ) {
+        //Ties go to the instruction that came last, so the original
+        //order is kept where it makes no difference
+        unsigned best = 0;
+        int bestDelta = 0;
+        for (unsigned r = 0, re = ready.size(); r != re; ++r) {
+          int delta = pressureDelta(region[ready[r]], live);
+          if (r == 0 || delta < bestDelta || (delta == bestDelta && ready[r] > ready[best])) {
+            best = r;
+            bestDelta = delta;
+          }
+        }
+        unsigned i = ready[best];
+        ready.erase(ready.begin() + best);
+        order[slot] = region[i];
+        stepUp(region[i], live);
+        for (unsigned k = 0, ke = preds[i].size(); k != ke; ++k)
+          if (--users[preds[i][k]] == 0)
+            ready.push_back(preds[i][k]);
+      }
+
+      RegPressure::Pressure scheduled = maxPressure(BB, order);
+      if (!(scheduled < before) || order == region)
+        return false;
+
+      Instruction *Term = BB->getTerminator();
+      for (unsigned i = 0, e = order.size(); i != e; ++i)
+        order[i]->moveBefore(Term);
+      after = scheduled;
+      ++NumBlocksScheduled;
+      NumPressureSaved += before.total() - after.total();
+      return true;
+    }
+  };
+
+char Schedule::ID = 0;
+RegisterPass<Schedule> X("sched-pass", "Pressure Scheduling Pass");
+}
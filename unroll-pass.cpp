@@ -0,0 +1,325 @@
+#include "llvm/Pass.h"
+#include "llvm/Support/CFG.h"
+#include "llvm/PassManager.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Analysis/Dominators.h"
+#include "llvm/Analysis/LoopPass.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ConstantFolding.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/raw_ostream.h"
+#include "CFGCleanup.cpp"
+#include <vector>
+
+using namespace llvm;
+using namespace std;
+
+STATISTIC(NumUnrolled, "Number of loops fully unrolled");
+STATISTIC(NumFolded, "Number of instructions folded to constants after unrolling");
+
+static cl::opt<unsigned> UnrollBudget("unroll-pass-threshold", cl::init(200),
+  cl::desc("Largest size, in instructions times trip count, that unroll-pass will fully unroll"));
+
+namespace
+{
+  // Fully unrolls innermost loops whose trip count is a small constant.
+  // The trip count comes from a header phi that starts at a constant
+  // and steps by a constant, compared against a constant in the one
+  // exiting block. The copies are chained, the exit test folds away and
+  // the straight line code is simplified with the dce-pass cleanups.
+  struct FullUnroll : public LoopPass {
+    static char ID;
+    FullUnroll() : LoopPass(ID) {}
+
+    private:
+    LoopInfo* LI;
+    DominatorTree* DT;
+    const DataLayout* TD;
+
+    virtual bool runOnLoop(Loop *L, LPPassManager &LPM)
+    {
+      LI = &getAnalysis<LoopInfo>();
+      DT = &getAnalysis<DominatorTree>();
+      TD = getAnalysisIfAvailable<DataLayout>();
+
+      //Sub loops would need their own copies in LoopInfo
+      if (!L->empty())
+        return false;
+
+      BasicBlock *Header = L->getHeader();
+      BasicBlock *Latch = L->getLoopLatch();
+      BasicBlock *Exiting = L->getExitingBlock();
+      BasicBlock *Exit = L->getUniqueExitBlock();
+      if (!L->getLoopPreheader() || !Latch || !Exiting || !Exit)
+        return false;
+      if (Exiting != Header && Exiting != Latch)
+        return false;
+      if (!canClone(L))
+        return false;
+
+      unsigned TripCount = getTripCount(L, Exiting);
+      if (TripCount == 0)
+        return false;
+      if (getLoopSize(L) * TripCount > UnrollBudget)
+        return false;
+
+      if (ScalarEvolution *SE = getAnalysisIfAvailable<ScalarEvolution>())
+        SE->forgetLoop(L);
+
+      Function *F = Header->getParent();
+      SmallVector<BasicBlock*, 32> Blocks;
+      unroll(L, TripCount, Blocks);
+
+      //The loop is gone, its blocks now belong to the parent loop
+      LPM.deleteLoopFromQueue(L);
+      cleanup(*F, Blocks);
+      ++NumUnrolled;
+      return true;
+    }
+
+    virtual void getAnalysisUsage(AnalysisUsage &AU) const {
+      AU.addRequired<LoopInfo>();
+      AU.addRequired<DominatorTree>();
+      AU.addPreserved<LoopInfo>();
+      AU.addPreserved<DominatorTree>();
+    }
+
+    bool canClone(Loop *L)
+    {
+      for (Loop::block_iterator b = L->block_begin(), be = L->block_end(); b != be; ++b)
+      {
+        if ((*b)->hasAddressTaken() || (*b)->isLandingPad())
+          return false;
+        if (isa<IndirectBrInst>((*b)->getTerminator()) || isa<InvokeInst>((*b)->getTerminator()))
+          return false;
+      }
+      return true;
+    }
+
+    unsigned getLoopSize(Loop *L)
+    {
+      unsigned size = 0;
+      for (Loop::block_iterator b = L->block_begin(), be = L->block_end(); b != be; ++b)
+        for (BasicBlock::iterator i = (*b)->getFirstNonPHI(), ie = (*b)->end(); i != ie; ++i)
+          if (!isa<DbgInfoIntrinsic>(i))
+            size++;
+      return size;
+    }
+
+    // Number of times the header runs, 0 if it is not a known
+    // constant within the size budget. The exit test compares either
+    // the phi or its increment against a constant bound; the test is
+    // replayed one iteration at a time until it leaves the loop.
+    unsigned getTripCount(Loop *L, BasicBlock *Exiting)
+    {
+      BranchInst *BI = dyn_cast<BranchInst>(Exiting->getTerminator());
+      if (!BI || !BI->isConditional())
+        return 0;
+      ICmpInst *Cmp = dyn_cast<ICmpInst>(BI->getCondition());
+      if (!Cmp)
+        return 0;
+
+      Value *Tested = Cmp->getOperand(0);
+      ConstantInt *Bound = dyn_cast<ConstantInt>(Cmp->getOperand(1));
+      ICmpInst::Predicate Pred = Cmp->getPredicate();
+      if (!Bound)
+      {
+        Tested = Cmp->getOperand(1);
+        Bound = dyn_cast<ConstantInt>(Cmp->getOperand(0));
+        Pred = Cmp->getSwappedPredicate();
+      }
+      if (!Bound)
+        return 0;
+
+      for (BasicBlock::iterator BBI = L->getHeader()->begin(); PHINode *PN = dyn_cast<PHINode>(BBI); ++BBI)
+      {
+        ConstantInt *Start = dyn_cast<ConstantInt>(PN->getIncomingValueForBlock(L->getLoopPreheader()));
+        BinaryOperator *Inc = dyn_cast<BinaryOperator>(PN->getIncomingValueForBlock(L->getLoopLatch()));
+        if (!Start || !Inc || (Tested != PN && Tested != Inc))
+          continue;
+
+        Constant *Step;
+        if (Inc->getOpcode() == Instruction::Add && Inc->getOperand(0) == PN)
+          Step = dyn_cast<ConstantInt>(Inc->getOperand(1));
+        else if (Inc->getOpcode() == Instruction::Add && Inc->getOperand(1) == PN)
+          Step = dyn_cast<ConstantInt>(Inc->getOperand(0));
+        else if (Inc->getOpcode() == Instruction::Sub && Inc->getOperand(0) == PN)
+          Step = dyn_cast<ConstantInt>(Inc->getOperand(1));
+        else
+          continue;
+        if (!Step)
+          continue;
+        if (Inc->getOpcode() == Instruction::Sub)
+          Step = ConstantExpr::getNeg(Step);
+
+        //Each iteration costs at least one instruction
+        Constant *IV = Start;
+        for (unsigned Trip = 1; Trip <= UnrollBudget; Trip++)
+        {
+          Constant *Next = ConstantExpr::getAdd(IV, Step);
+          ConstantInt *Taken = dyn_cast<ConstantInt>(ConstantExpr::getICmp(Pred, Tested == PN ? IV : Next, Bound));
+          if (!Taken)
+            return 0;
+          if (!L->contains(BI->getSuccessor(Taken->isZero() ? 1 : 0)))
+            return Trip;
+          IV = Next;
+        }
+        return 0;
+      }
+      return 0;
+    }
+
+    // Chains TripCount copies of the loop body. Copy 0 is the loop
+    // itself, the header phis of copy i become the latch values of
+    // copy i - 1. Only the exiting block of the last copy leaves.
+    void unroll(Loop *L, unsigned TripCount, SmallVectorImpl<BasicBlock*> &Blocks)
+    {
+      BasicBlock *Header = L->getHeader();
+      BasicBlock *Latch = L->getLoopLatch();
+      BasicBlock *Preheader = L->getLoopPreheader();
+      BasicBlock *Exiting = L->getExitingBlock();
+      BasicBlock *Exit = L->getUniqueExitBlock();
+      Function *F = Header->getParent();
+
+      vector<BasicBlock*> LoopBlocks = L->getBlocks();
+      Blocks.append(LoopBlocks.begin(), LoopBlocks.end());
+
+      //Uses after the loop get the values of the last copy
+      SmallVector<pair<Instruction*, Use*>, 8> OutsideUses;
+      for (unsigned i = 0, e = LoopBlocks.size(); i != e; ++i)
+        for (BasicBlock::iterator I = LoopBlocks[i]->begin(), IE = LoopBlocks[i]->end(); I != IE; ++I)
+          for (Value::use_iterator UI = I->use_begin(), UE = I->use_end(); UI != UE; ++UI)
+            if (!L->contains(cast<Instruction>(*UI)))
+              OutsideUses.push_back(make_pair((Instruction*)I, &UI.getUse()));
+
+      SmallVector<PHINode*, 8> HeaderPhis;
+      for (BasicBlock::iterator BBI = Header->begin(); PHINode *PN = dyn_cast<PHINode>(BBI); ++BBI)
+        HeaderPhis.push_back(PN);
+
+      DenseMap<Value*, Value*> LastValueMap;
+      for (unsigned i = 0, e = Blocks.size(); i != e; ++i)
+        for (BasicBlock::iterator I = Blocks[i]->begin(), IE = Blocks[i]->end(); I != IE; ++I)
+          LastValueMap[I] = I;
+
+      vector<BasicBlock*> Headers(1, Header), Latches(1, Latch), Exitings(1, Exiting);
+      for (unsigned It = 1; It != TripCount; ++It)
+      {
+        ValueToValueMapTy VMap;
+        SmallVector<BasicBlock*, 8> NewBlocks;
+        for (unsigned i = 0, e = LoopBlocks.size(); i != e; ++i)
+        {
+          BasicBlock *NewBB = CloneBasicBlock(LoopBlocks[i], VMap, "." + Twine(It), F);
+          VMap[LoopBlocks[i]] = NewBB;
+          L->addBasicBlockToLoop(NewBB, LI->getBase());
+          NewBlocks.push_back(NewBB);
+        }
+
+        for (unsigned i = 0, e = HeaderPhis.size(); i != e; ++i)
+        {
+          PHINode *NewPN = cast<PHINode>(VMap[HeaderPhis[i]]);
+          Value *V = HeaderPhis[i]->getIncomingValueForBlock(Latch);
+          if (Instruction *I = dyn_cast<Instruction>(V))
+            if (L->contains(I))
+              V = LastValueMap[I];
+          VMap[HeaderPhis[i]] = V;
+          NewPN->eraseFromParent();
+        }
+
+        for (unsigned i = 0, e = NewBlocks.size(); i != e; ++i)
+          for (BasicBlock::iterator I = NewBlocks[i]->begin(), IE = NewBlocks[i]->end(); I != IE; ++I)
+            RemapInstruction(I, VMap, RF_NoModuleLevelChanges | RF_IgnoreMissingEntries);
+
+        for (ValueToValueMapTy::iterator VI = VMap.begin(), VE = VMap.end(); VI != VE; ++VI)
+          LastValueMap[VI->first] = VI->second;
+
+        Headers.push_back(cast<BasicBlock>(VMap[Header]));
+        Latches.push_back(cast<BasicBlock>(VMap[Latch]));
+        Exitings.push_back(cast<BasicBlock>(VMap[Exiting]));
+        Blocks.append(NewBlocks.begin(), NewBlocks.end());
+      }
+
+      //The exit test is known in every copy: stay in all but the last
+      for (unsigned i = 0; i != TripCount; ++i)
+      {
+        BranchInst *BI = cast<BranchInst>(Exitings[i]->getTerminator());
+        BasicBlock *Dest = Exit;
+        if (i + 1 != TripCount)
+          Dest = BI->getSuccessor(BI->getSuccessor(0) == Exit ? 1 : 0);
+        BranchInst::Create(Dest, BI);
+        BI->eraseFromParent();
+      }
+      for (unsigned i = 0; i + 1 < TripCount; ++i)
+        Latches[i]->getTerminator()->replaceUsesOfWith(Headers[i], Headers[i + 1]);
+
+      BasicBlock *LastExiting = Exitings.back();
+      for (BasicBlock::iterator BBI = Exit->begin(); PHINode *PN = dyn_cast<PHINode>(BBI); ++BBI)
+        for (unsigned i = 0, e = PN->getNumIncomingValues(); i != e; ++i)
+          if (PN->getIncomingBlock(i) == Exiting)
+            PN->setIncomingBlock(i, LastExiting);
+      for (unsigned i = 0, e = OutsideUses.size(); i != e; ++i)
+        OutsideUses[i].second->set(LastValueMap[OutsideUses[i].first]);
+
+      //Copy 0 is only entered from the preheader
+      for (unsigned i = 0, e = HeaderPhis.size(); i != e; ++i)
+      {
+        HeaderPhis[i]->replaceAllUsesWith(HeaderPhis[i]->getIncomingValueForBlock(Preheader));
+        HeaderPhis[i]->eraseFromParent();
+      }
+    }
+
+    // Constant folding and dead instruction removal over the copies,
+    // then the CFG cleanups of dce-pass with LoopInfo kept up to date
+    void cleanup(Function &F, SmallVectorImpl<BasicBlock*> &Blocks)
+    {
+      bool changed;
+      do
+      {
+        changed = false;
+        for (unsigned b = 0, be = Blocks.size(); b != be; ++b)
+          for (BasicBlock::iterator II = Blocks[b]->begin(), IE = Blocks[b]->end(); II != IE; )
+          {
+            Instruction *I = II++;
+            if (isInstructionTriviallyDead(I))
+            {
+              I->eraseFromParent();
+              changed = true;
+            }
+            else if (Constant *C = ConstantFoldInstruction(I, TD))
+            {
+              I->replaceAllUsesWith(C);
+              I->eraseFromParent();
+              ++NumFolded;
+              changed = true;
+            }
+          }
+      } while (changed);
+
+      foldConstantBranches(Blocks);
+      deleteUnreachableBlocks(F, LI);
+
+      //Merging keeps the dominator tree in step, so it has to be right first
+      DT->runOnFunction(F);
+      SmallPtrSet<BasicBlock*, 32> Unrolled(Blocks.begin(), Blocks.end());
+      SmallVector<BasicBlock*, 32> Remaining;
+      for (Function::iterator b = F.begin(), be = F.end(); b != be; b++)
+        if (Unrolled.count(b))
+          Remaining.push_back(b);
+      mergeBlockChains(Remaining, this);
+    }
+  };
+
+char FullUnroll::ID = 0;
+RegisterPass<FullUnroll> X("unroll-pass", "Full Unroll Pass");
+}